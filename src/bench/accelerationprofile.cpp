@@ -0,0 +1,104 @@
+/*
+ * Printipi/bench/accelerationprofile.cpp
+ * (c) 2014 Colin Wallace
+ *
+ * Microbenchmark of the AccelerationProfiles under motion/.
+ * For a series of random moves, it reports the cost of each profile's begin() (once per move) and transform() (once per step),
+ *   and checks the table-driven ExponentialAcceleration against the exact transform it approximates (whose cost is also reported).
+ * Build with `make bench` and run $(BUILDROOT)/bench/accelerationprofile
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib> //for rand
+#include <cmath>
+#include <vector>
+#include <algorithm> //for max
+#include "motion/constantacceleration.h"
+#include "motion/exponentialacceleration.h"
+#include "motion/scurveacceleration.h"
+
+#define ACCEL1000 900000
+#define JERK1000 90000000
+#define NUM_MOVES 2000
+#define STEPS_PER_MOVE 2000
+
+struct Move {
+    float duration; //sec, at constant velocity
+    float vmax; //mm/sec
+};
+
+//the transform that ExponentialAcceleration tabulates, evaluated directly (see motion/exponentialacceleration.h)
+double exactExponential(double t, double duration, double Vmax) {
+    if (t > 0.5*duration) {
+        return 2*exactExponential(0.5*duration, duration, Vmax) - exactExponential(duration-t, duration, Vmax);
+    }
+    double V0 = std::min(0.5*Vmax, 0.1);
+    double k = 4*(ACCEL1000/1000.)/Vmax;
+    double c = V0 / (Vmax-V0);
+    return 1./k * std::log(1./c * ((1. + c)*std::exp(k*t) - 1.));
+}
+
+//ExponentialAcceleration without the table, for comparison
+struct DirectExponentialAcceleration : public AccelerationProfile {
+    float duration, Vmax;
+    void begin(float moveDuration, float Vmax, float /*Vstart*/=0, float /*Vend*/=0) {
+        this->duration = moveDuration;
+        this->Vmax = Vmax;
+    }
+    StepTimeT transform(StepTimeT time) {
+        return StepTimeT((StepTimeT::rep)(exactExponential(time.count()*1e-9, duration, Vmax)*1e9 + 0.5));
+    }
+};
+
+//Time NUM_MOVES calls to begin(), then STEPS_PER_MOVE calls to transform() for each move.
+//Returns the sum of all transformed times, so that the work can't be optimized away.
+template <typename ProfileT> StepTimeT::rep runProfile(const char *name, const std::vector<Move> &moves) {
+    ProfileT profile;
+    StepTimeT::rep checksum = 0;
+    double beginSec = 0, transformSec = 0;
+    for (const Move &m : moves) {
+        auto start = std::chrono::steady_clock::now();
+        profile.begin(m.duration, m.vmax);
+        auto mid = std::chrono::steady_clock::now();
+        StepTimeT::rep step = (StepTimeT::rep)(m.duration*1e9) / STEPS_PER_MOVE;
+        for (int i=1; i<=STEPS_PER_MOVE; ++i) {
+            checksum += profile.transform(StepTimeT(i*step)).count();
+        }
+        auto end = std::chrono::steady_clock::now();
+        beginSec += std::chrono::duration<double>(mid - start).count();
+        transformSec += std::chrono::duration<double>(end - mid).count();
+    }
+    printf("%-26s begin: %8.1f ns/move, transform: %6.2f ns/step (checksum %lld)\n", name, beginSec/moves.size()*1e9, transformSec/moves.size()/STEPS_PER_MOVE*1e9, (long long)checksum);
+    return checksum;
+}
+
+int main() {
+    srand(1);
+    std::vector<Move> moves;
+    for (int i=0; i<NUM_MOVES; ++i) {
+        Move m;
+        m.duration = 0.005f + 2.f*rand()/RAND_MAX;
+        m.vmax = 10.f + 140.f*rand()/RAND_MAX;
+        moves.push_back(m);
+    }
+    runProfile<ConstantAcceleration<ACCEL1000> >("ConstantAcceleration", moves);
+    runProfile<ExponentialAcceleration<ACCEL1000> >("ExponentialAcceleration", moves);
+    runProfile<DirectExponentialAcceleration>("(untabulated exponential)", moves);
+    runProfile<SCurveAcceleration<ACCEL1000, JERK1000> >("SCurveAcceleration", moves);
+
+    //accuracy of the ExponentialAcceleration table:
+    ExponentialAcceleration<ACCEL1000> exponential;
+    double maxErr = 0;
+    for (const Move &m : moves) {
+        exponential.begin(m.duration, m.vmax);
+        //Note: the very end of the move is excluded. The profile decelerates to V0 (~0.1 mm/sec) there, so a 1 ns change in t shifts the real time by ~1 usec.
+        for (int i=0; i<STEPS_PER_MOVE; ++i) {
+            StepTimeT t((StepTimeT::rep)(m.duration*1e9*i/STEPS_PER_MOVE));
+            double approx = exponential.transform(t).count()*1e-9;
+            maxErr = std::max(maxErr, std::fabs(approx - exactExponential(t.count()*1e-9, m.duration, m.vmax)));
+        }
+    }
+    printf("ExponentialAcceleration table: max error vs exact transform: %f usec\n", maxErr*1e6);
+    return 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * Printipi/bench/inputshaper.cpp
+ * (c) 2014 Colin Wallace
+ *
+ * Benchmark of the MotionPlanner with & without input shaping (see motion/inputshaper.h), on the geometry of a Kossel-like machine.
+ * A long series of short, blended moves (as a slicer produces for curved perimeters & infill) is queued and stepped through with each shaper.
+ * It reports the steps/sec achieved, how long the whole series takes to carry out (shaping should only add about one shaper duration to it),
+ *   whether the step times ever go backwards, and how far the axes end up from the final destination.
+ * The unshaped run must take exactly the steps that the carriages' travel along the path calls for (counted from the geometry, independent of the steppers), or the bench fails.
+ * The shaped path rounds off the corners, so the carriages travel less and it takes fewer steps (about 1-2% fewer here).
+ * Build with `make bench` and run $(BUILDROOT)/bench/inputshaper
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib> //for rand
+#include <cmath>
+#include <vector>
+#include <array>
+#include <algorithm> //for std::max
+#include <tuple>
+#include "schedulerbase.h"
+#include "drivers/lineardeltacoordmap.h"
+#include "drivers/lineardeltastepper.h"
+#include "drivers/linearstepper.h"
+#include "motion/motionplanner.h"
+#include "motion/constantacceleration.h"
+#include "motion/inputshaper.h"
+
+//machine geometry (from machines/rpi/kosselpi.h):
+#define R1000 111000
+#define L1000 221000
+#define H1000 467200
+#define BUILDRAD1000 85000
+#define STEPS_M 6265*8
+#define STEPS_M_EXT 30000*16
+#define ACCEL1000 3000000
+#define RING_FREQ1000 40000
+#define MOVE_RATE 120 //mm/sec
+#define JUNCTION_DEVIATION 0.05 //mm
+#define NUM_MOVES 5000
+#define BATCH_LEN 64
+
+typedef drv::LinearDeltaCoordMap<R1000, L1000, H1000, BUILDRAD1000, STEPS_M, STEPS_M_EXT> CoordMapT;
+typedef std::tuple<drv::LinearDeltaStepper<0, CoordMapT, R1000, L1000, STEPS_M>, drv::LinearDeltaStepper<1, CoordMapT, R1000, L1000, STEPS_M>,
+    drv::LinearDeltaStepper<2, CoordMapT, R1000, L1000, STEPS_M>, drv::LinearStepper<STEPS_M_EXT, COORD_E> > KosselStepperTypes;
+
+struct KosselInterface {
+    typedef ::CoordMapT CoordMapT;
+    typedef KosselStepperTypes AxisStepperTypes;
+};
+
+struct Move {
+    float x, y, z, e; //destination
+};
+
+//step through every move, and return the number of steps taken. dest is the mechanical position (in steps) that the axes should end up at.
+template <typename Interface, typename Shaper> std::size_t runShaper(const char *name, const std::vector<Move> &moves, const std::array<float, 4> &dest, std::size_t unshapedSteps) {
+    MotionPlanner<Interface, ConstantAcceleration<ACCEL1000>, Shaper> planner;
+    std::array<int, 4> pos = {{0, 0, 0, 0}}; //the planner begins from mechanical position 0
+    std::array<Event, BATCH_LEN> events;
+    std::size_t numSteps = 0, numBackwards = 0;
+    EventClockT::time_point lastTime;
+    auto start = std::chrono::steady_clock::now();
+    std::size_t next = 0;
+    while (true) {
+        while (next < moves.size() && planner.readyForNextMove()) {
+            const Move &m = moves[next++];
+            planner.moveTo(EventClockT::time_point(), m.x, m.y, m.z, m.e, MOVE_RATE, -MOVE_RATE, MOVE_RATE, JUNCTION_DEVIATION, 0);
+        }
+        std::size_t n = planner.nextSteps(events.data(), events.size());
+        if (n == 0 && next == moves.size()) {
+            break;
+        }
+        for (std::size_t i=0; i<n; ++i) {
+            numBackwards += events[i].time() < lastTime;
+            lastTime = events[i].time();
+            pos[events[i].stepperId()] += stepDirToSigned<int>(events[i].direction());
+        }
+        numSteps += n;
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    float maxErr = 0;
+    for (std::size_t i=0; i<pos.size(); ++i) {
+        maxErr = std::max(maxErr, std::fabs(pos[i] - dest[i]));
+    }
+    printf("%-18s %8.0f steps/sec (%zu steps, %+ld vs unshaped), print takes %.4f sec, %zu steps out of order, final position (%i, %i, %i, %i) is within %.2f steps of the destination\n", name,
+        numSteps/elapsed, numSteps, unshapedSteps ? (long)numSteps - (long)unshapedSteps : 0L, std::chrono::duration<double>(lastTime.time_since_epoch()).count(), numBackwards, 
+        pos[0], pos[1], pos[2], pos[3], maxErr);
+    return numSteps;
+}
+
+//position of the given mechanical axis (in steps) with the effector at (x, y, z, e), in double precision:
+double axisPosition(int axis, double x, double y, double z, double e) {
+    if (axis == 3) {
+        return e*STEPS_M_EXT/1000.;
+    }
+    double dx = x - drv::LinearDeltaTowers<R1000>::x(axis), dy = y - drv::LinearDeltaTowers<R1000>::y(axis);
+    return (z + std::sqrt(L1000/1000.*L1000/1000. - dx*dx - dy*dy))*STEPS_M/1000.;
+}
+
+//the number of steps that following the (unshaped) path takes, found from the geometry alone rather than from any AxisStepper.
+//An axis at mechanical position p steps forward once its position along the path reaches p+1 steps, and backward once it falls to p-1.
+//Along a straight move each carriage's height is concave (and the extruder's position linear), so it rises to at most one peak and then falls.
+std::size_t pathSteps(const std::vector<Move> &moves) {
+    std::array<int, 4> pos = {{0, 0, 0, 0}};
+    float x0, y0, z0, e0;
+    std::tie(x0, y0, z0, e0) = CoordMapT::xyzeFromMechanical(pos);
+    std::size_t numSteps = 0;
+    for (const Move &m : moves) {
+        for (int axis=0; axis<4; ++axis) {
+            auto at = [&](double s) { return axisPosition(axis, x0 + s*(m.x-x0), y0 + s*(m.y-y0), z0 + s*(m.z-z0), e0 + s*(m.e-e0)); };
+            //golden section search for the peak:
+            double lo = 0, hi = 1;
+            for (int i=0; i<80; ++i) {
+                double a = hi - 0.6180339887*(hi-lo), b = lo + 0.6180339887*(hi-lo);
+                if (at(a) < at(b)) {
+                    lo = a;
+                } else {
+                    hi = b;
+                }
+            }
+            double peak = std::max(at(0.5*(lo+hi)), std::max(at(0), at(1)));
+            for (; peak >= pos[axis]+1; ++pos[axis]) {
+                ++numSteps;
+            }
+            for (double end = at(1); end <= pos[axis]-1; --pos[axis]) {
+                ++numSteps;
+            }
+        }
+        std::tie(x0, y0, z0, e0) = std::make_tuple(m.x, m.y, m.z, m.e);
+    }
+    return numSteps;
+}
+
+int main() {
+    //a wandering path of short moves over the bed, turning by up to 45 degrees at each joint
+    srand(1);
+    std::vector<Move> moves;
+    float x = 0, y = 0, e = 0, angle = 0;
+    for (int i=0; i<NUM_MOVES; ++i) {
+        float len = 0.5f + 2.5f*rand()/RAND_MAX;
+        angle += 1.5708f*((float)rand()/RAND_MAX - 0.5f);
+        if (std::hypot(x + len*std::cos(angle), y + len*std::sin(angle)) > 60) {
+            angle += 3.14159f; //turn back toward the center
+        }
+        x += len*std::cos(angle);
+        y += len*std::sin(angle);
+        e += 0.05f*len;
+        Move m = { x, y, 10, e };
+        moves.push_back(m);
+    }
+    //where the axes should end up, from the exact kinematics (independent of the steppers being run):
+    std::array<float, 4> dest;
+    const Move &last = moves.back();
+    drv::AxisStepper::mechanicalPositionsAt<KosselStepperTypes>(dest, last.x, last.y, last.z, last.e);
+    std::size_t expectedSteps = pathSteps(moves);
+    printf("destination: (%.2f, %.2f, %.2f, %.2f), reached in %zu steps along the unshaped path\n", dest[0], dest[1], dest[2], dest[3], expectedSteps);
+    std::size_t unshapedSteps = runShaper<KosselInterface, NoInputShaper>("unshaped", moves, dest, 0);
+    runShaper<KosselInterface, ZvShaper<RING_FREQ1000> >("ZV", moves, dest, unshapedSteps);
+    runShaper<KosselInterface, ZvdShaper<RING_FREQ1000> >("ZVD", moves, dest, unshapedSteps);
+    runShaper<KosselInterface, EiShaper<RING_FREQ1000> >("EI", moves, dest, unshapedSteps);
+    if (unshapedSteps != expectedSteps) {
+        printf("FAILED: the unshaped run took %zu steps, but the path calls for %zu\n", unshapedSteps, expectedSteps);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,71 @@
+#ifndef COMMON_RINGBUFFER_H
+#define COMMON_RINGBUFFER_H
+
+/*
+ * Printipi/common/ringbuffer.h
+ * (c) 2014 Colin Wallace
+ *
+ * RingBuffer is a fixed-capacity FIFO queue whose storage is allocated up-front (no heap allocations).
+ * Items are pushed to the back and popped from the front, but any queued item can be accessed by its distance from the front.
+ * This makes it useful for things like the motion planner, which needs to revisit every queued segment each time a new one is added.
+ */
+
+#include <array>
+#include <cstddef> //for size_t
+#include <cassert>
+
+template <typename T, std::size_t Capacity> class RingBuffer {
+    static_assert(Capacity > 0, "RingBuffer must have a nonzero capacity");
+    std::array<T, Capacity> _items;
+    std::size_t _head; //index (into _items) of the front (oldest) item
+    std::size_t _size; //number of items currently queued
+    public:
+        RingBuffer() : _items(), _head(0), _size(0) {}
+        static constexpr std::size_t capacity() {
+            return Capacity;
+        }
+        inline std::size_t size() const {
+            return _size;
+        }
+        inline bool empty() const {
+            return _size == 0;
+        }
+        inline bool full() const {
+            return _size == Capacity;
+        }
+        //access the item that is idx positions behind the front (ie [0] is the front, [size()-1] is the back)
+        inline T& operator[](std::size_t idx) {
+            return _items[(_head + idx) % Capacity];
+        }
+        inline const T& operator[](std::size_t idx) const {
+            return _items[(_head + idx) % Capacity];
+        }
+        inline T& front() {
+            return (*this)[0];
+        }
+        inline const T& front() const {
+            return (*this)[0];
+        }
+        inline T& back() {
+            return (*this)[_size-1];
+        }
+        inline const T& back() const {
+            return (*this)[_size-1];
+        }
+        inline void push_back(const T &item) {
+            assert(!full());
+            (*this)[_size] = item;
+            ++_size;
+        }
+        inline void pop_front() {
+            assert(!empty());
+            _head = (_head + 1) % Capacity;
+            --_size;
+        }
+        inline void clear() {
+            _head = 0;
+            _size = 0;
+        }
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef COMMON_SPSCRINGBUFFER_H
+#define COMMON_SPSCRINGBUFFER_H
+
+/*
+ * Printipi/common/spscringbuffer.h
+ * (c) 2014 Colin Wallace
+ *
+ * SpscRingBuffer is a fixed-capacity FIFO queue that may be pushed to by one thread while another thread pops from it, without any locks.
+ * Every operation completes in a bounded number of steps (it is wait-free), so a slow consumer can never block the producer, or vice-versa;
+ *   the producer just sees the queue as full (and the consumer sees it as empty) until the other side catches up.
+ * Only the producer may call push_back, and only the consumer may call front/pop_front. size(), empty() & full() may be called from either, but are only snapshots.
+ * The interface otherwise mirrors RingBuffer, so that either can be used for a queue depending on whether it's shared between threads.
+ */
+
+#include <array>
+#include <atomic>
+#include <cstddef> //for size_t
+#include <cassert>
+
+#ifndef SPSCRINGBUFFER_CACHE_LINE
+    #define SPSCRINGBUFFER_CACHE_LINE 64 //bytes. 32 on the original Raspberry Pi (ARM1176), but 64 on later ARM cores & x86
+#endif
+
+template <typename T, std::size_t Capacity> class SpscRingBuffer {
+    static_assert(Capacity > 0, "SpscRingBuffer must have a nonzero capacity");
+    static_assert((Capacity & (Capacity-1)) == 0, "SpscRingBuffer capacity must be a power of two, so that the free-running counters can wrap");
+    //_head and _tail are free-running counts of the items ever popped and pushed; the item at counter n is stored in _items[n % Capacity].
+    //Each is written by only one thread, and they're padded onto separate cache lines so that the two threads don't fight over the same line.
+    //(padding rather than alignas, as gcc < 4.8 doesn't support alignas)
+    std::atomic<std::size_t> _head; //written by the consumer
+    char _padHead[SPSCRINGBUFFER_CACHE_LINE];
+    std::atomic<std::size_t> _tail; //written by the producer
+    char _padTail[SPSCRINGBUFFER_CACHE_LINE];
+    std::array<T, Capacity> _items;
+    public:
+        SpscRingBuffer() : _head(0), _padHead(), _tail(0), _padTail(), _items() {}
+        static constexpr std::size_t capacity() {
+            return Capacity;
+        }
+        inline std::size_t size() const {
+            //load _head first: it can only catch up to _tail, so this never underflows.
+            std::size_t head = _head.load(std::memory_order_acquire);
+            return _tail.load(std::memory_order_acquire) - head;
+        }
+        inline bool empty() const {
+            return size() == 0;
+        }
+        inline bool full() const {
+            return size() == Capacity;
+        }
+        //consumer side:
+        inline T& front() {
+            assert(!empty());
+            return _items[_head.load(std::memory_order_relaxed) % Capacity];
+        }
+        //access the item that is idx positions behind the front. Only items counted by a prior call to size() may be accessed.
+        inline T& operator[](std::size_t idx) {
+            return _items[(_head.load(std::memory_order_relaxed) + idx) % Capacity];
+        }
+        inline void pop_front() {
+            assert(!empty());
+            //release: the producer mustn't overwrite the slot until we're done reading it.
+            _head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+        //producer side:
+        inline void push_back(const T &item) {
+            assert(!full());
+            std::size_t tail = _tail.load(std::memory_order_relaxed);
+            _items[tail % Capacity] = item;
+            //release: the consumer mustn't see the new tail before it can see the item.
+            _tail.store(tail + 1, std::memory_order_release);
+        }
+};
+
+#endif
@@ -2,9 +2,13 @@
 #define COMMON_TYPESETTINGS_PRIMITIVES_H
 
 #include <cstdint> //for uint8_t
+#include <chrono> //for nanoseconds
 
 typedef uint8_t AxisIdType;
 typedef int GpioPinIdType; //Even if a machine only has 64 gpio pins, they may be separated into, say, 2 side-by-side bytes. So use an int by default.
 typedef float CelciusType;
+//Time of a step, relative to the start of its move. Integer nanoseconds (rather than float seconds) so that step times keep the same resolution
+//  throughout long moves, and so that converting to an EventClockT::duration is integer arithmetic.
+typedef std::chrono::nanoseconds StepTimeT;
 
 #endif
@@ -44,6 +44,7 @@
 #include "common/logging.h"
 #include "outputevent.h"
 #include "event.h"
+#include "stepdiroutputs.h"
 
 namespace drv {
 
@@ -89,9 +90,10 @@ template <typename StepPin=NoPin, typename DirPin=NoPin, typename EnablePin=NoPi
             return true;
         }
         std::array<OutputEvent, 3> getEventOutputSequence(const Event &evt) {
-            return {{OutputEvent(evt.time(), dirPin.id(), evt.direction() == StepForward ? IoHigh : IoLow),
-                OutputEvent(evt.time(), stepPin.id(), IoLow),
-                OutputEvent(evt.time()+std::chrono::microseconds(8), stepPin.id(), IoHigh)}}; //It's the low->high transition that triggers the step. NOTE: documentation says only 1 uS delay is necessary, but < 15 causes consistent problems. May be DMA scheduling
+            return getStepDirOutputs().outputSequence(evt);
+        }
+        StepDirOutputs getStepDirOutputs() const {
+            return StepDirOutputs(dirPin.id(), stepPin.id(), std::chrono::microseconds(8)); //NOTE: documentation says only 1 uS pulse is necessary, but < 15 causes consistent problems. May be DMA scheduling
         }
     private:
         //A4988 is directed by putting a direction on the DIRPIN, and then
@@ -7,7 +7,7 @@ namespace drv {
 Event AxisStepper::getEvent() const {
     return Event::StepperEvent(this->time, this->index(), this->direction);
 }
-Event AxisStepper::getEvent(float realTime) const {
+Event AxisStepper::getEvent(StepTimeT realTime) const {
     return Event::StepperEvent(realTime, this->index(), this->direction);
 }
 
@@ -27,8 +27,13 @@
  * AxisSteppers are used to queue movements.
  * When a movement is desired, an AxisStepper is instantiated for each MECHANICAL axis (eg each pillar of a Kossel, plus extruders. Or perhaps an X stepper, a Y stepper, a Z stepper, and an extruder for a cartesian bot).
  * The AxisStepper provides the relative time at which its associated axis should next be advanced, as well as in what mechanical direction, given an initial mechanical position and cartesian velocity.
+ * It is also given the cartesian position that the path starts from. This is the position the MotionPlanner last commanded, which may differ from the mechanical position by a fraction of a step;
+ *   AxisSteppers should step whenever the path crosses a whole step of their mechanical axis, so that this rounding never accumulates across moves.
+ *   (Recovering the cartesian position from the mechanical one would instead require the CoordMap's forward kinematics, which can be expensive - eg for a deltabot)
  * It also implements the 'nextStep' method, which will update the time & direction of the step that would follow the current one. In this way, the AxisStepper can be queried for the 1st step, 2nd step, and so on, for the given path.
  *
+ * AxisSteppers may also support arcs (G2/G3), in which case they provide a constructor that takes an ArcPath in place of the cartesian velocity.
+ *
  * Note: AxisStepper is an interface, and not an implementation.
  * An implementation is needed for each coordinate style - Cartesian, deltabot, etc.
  * These implementations must provide the functions outlined further down in the header.
@@ -42,29 +47,98 @@
 #include "common/typesettings/primitives.h" //for AxisIdType
 #include <tuple>
 #include <array>
-#include <cmath> //for isnan
+#include <cmath> //for isnan, acos
+#include <algorithm> //for std::min
+#include <type_traits> //for std::integral_constant, is_constructible
+
+//Number of points at which an ExtrusionPath is tabulated
+#ifndef AXISSTEPPER_EXTRUSION_PATH_SAMPLES
+    #define AXISSTEPPER_EXTRUSION_PATH_SAMPLES 64
+#endif
 
 namespace drv {
 
+//An arc in the XY plane (or a helix, if z changes), traversed at constant speed. Relative to the start of the move:
+//  x(t) = centerX + radius*cos(startAngle + angularVel*t)
+//  y(t) = centerY + radius*sin(startAngle + angularVel*t)
+//  z(t) = z0 + vz*t, e(t) = e0 + ve*t
+//where (x(0), y(0), z0, e0) is the cartesian position of the machine at the start of the move.
+struct ArcPath {
+    float centerX, centerY; //mm
+    float radius; //mm
+    float startAngle; //radians
+    float angularVel; //radians/sec. Positive is counter-clockwise (G3) and negative is clockwise (G2)
+    float z0, e0; //mm
+    float vz, ve; //mm/sec
+};
+
+//The displacement of the extruder over a move for which it doesn't move at a constant velocity (eg with pressure advance - see MotionPlanner).
+//At time[i] (seconds since the start of the move, at constant velocity), the extruder has moved dist[i] mm from where it began, and it moves linearly between samples.
+//time[0] = dist[0] = 0, time is increasing, and dist never turns back from the direction of dist[last].
+struct ExtrusionPath {
+    std::array<float, AXISSTEPPER_EXTRUSION_PATH_SAMPLES> time;
+    std::array<float, AXISSTEPPER_EXTRUSION_PATH_SAMPLES> dist;
+};
+
 class AxisStepper {
     private:
         AxisIdType _index; //ID of axis. Does not necessarily have to be stored as a variable (other option is one template instance per ID, which pretty much already happens), but this allows AxisStepper::nextStep() to not be virtual
     public:
-        float time; //time of next step
+        StepTimeT time; //time of next step (relative to the start of the move, at constant velocity), or noStep() if there is none
         StepDirection direction; //direction of next step
         inline int index() const { return _index; } //NOT TO BE OVERRIDEN
-        AxisStepper() {}
+        AxisStepper() : time(noStep()), direction(StepForward) {}
         //standard initializer:
-        template <std::size_t sz> AxisStepper(int idx, const std::array<int, sz>& /*curPos*/, float /*vx*/, float /*vy*/, float /*vz*/, float /*ve*/)
-            : _index(idx) {}
-        //initializer when homing to endstops:
-        AxisStepper(int idx, float /*vHome*/) : _index(idx) {}
+        template <std::size_t sz> AxisStepper(int idx, const std::array<int, sz>& /*curPos*/, float /*x0*/, float /*y0*/, float /*z0*/, float /*e0*/, float /*vx*/, float /*vy*/, float /*vz*/, float /*ve*/)
+            : _index(idx), time(noStep()), direction(StepForward) {}
+        //initializer for arcs (only needed by AxisSteppers that support them):
+        template <std::size_t sz> AxisStepper(int idx, const std::array<int, sz>& /*curPos*/, const ArcPath& /*arc*/)
+            : _index(idx), time(noStep()), direction(StepForward) {}
+        //initializer when homing to endstops. Home steppers must also accept a third argument, backOffDist (mm): if nonzero, the axis moves that far away from its endstop instead.
+        AxisStepper(int idx, float /*vHome*/) : _index(idx), time(noStep()), direction(StepForward) {}
         template <typename TupleT> static AxisStepper& getNextTime(TupleT &axes);
-        template <typename TupleT, std::size_t MechSize> static void initAxisSteppers(TupleT &steppers, const std::array<int, MechSize>& curPos, float vx, float vy, float vz, float ve);
-        template <typename TupleT> static void initAxisHomeSteppers(TupleT &steppers, float vHome);
+        template <typename TupleT, std::size_t MechSize> static void initAxisSteppers(TupleT &steppers, const std::array<int, MechSize>& curPos, float x0, float y0, float z0, float e0, float vx, float vy, float vz, float ve);
+        template <typename TupleT, std::size_t MechSize> static void initAxisArcSteppers(TupleT &steppers, const std::array<int, MechSize>& curPos, const ArcPath &arc);
+        template <typename TupleT> static void initAxisHomeSteppers(TupleT &steppers, float vHome, float backOffDist=0);
+        //read the endstop of each (home) AxisStepper in the tuple, so that homing stops even if it's triggered between the steps of that axis.
+        template <typename TupleT> static void sampleEndstops(TupleT &steppers);
+        //make every extruder in the (initialized) tuple follow the path instead of the velocity it was initialized with. The path must outlive the move.
+        template <typename TupleT> static void followExtrusionPath(TupleT &steppers, const ExtrusionPath &path);
+        //fill pos with the (fractional) mechanical position of each axis in the tuple, in steps, when the effector is at (x, y, z, e). An axis that can't tell is given NaN.
+        template <typename TupleT, std::size_t MechSize> static void mechanicalPositionsAt(std::array<float, MechSize> &pos, float x, float y, float z, float e);
         Event getEvent() const; //NOT TO BE OVERRIDEN
-        Event getEvent(float realTime) const; //NOT TO BE OVERRIDEN
+        Event getEvent(StepTimeT realTime) const; //NOT TO BE OVERRIDEN
+        //value of time indicating that there are no more steps on this path:
+        static constexpr StepTimeT noStep() { return StepTimeT::max(); }
+        //Most AxisSteppers solve their kinematics in floating-point seconds; this converts such a result to a StepTimeT.
+        //NaN, negative or absurdly large times indicate that there is no (next) step.
+        //Steppers should solve for (at least) the time itself in double: a float only resolves ~8us at 100 seconds into a move.
+        static inline StepTimeT timeFromSeconds(double seconds) {
+            return (seconds >= 0 && seconds < 1e9) ? StepTimeT((StepTimeT::rep)(seconds*1e9 + 0.5)) : noStep();
+        }
+        static inline float secondsFromTime(StepTimeT time) {
+            return time.count()*1e-9f;
+        }
+        //For AxisSteppers that follow an arc: the earliest time after t (in seconds) at which cos(phase + angularVel*t) == c, or NaN if there is none.
+        //The angle swept so far is kept in double, so that the result is as precise late in a long arc as at its start.
+        static inline double arcTimeOfCos(float c, float phase, float angularVel, double t) {
+            if (!(c >= -1 && c <= 1)) {
+                return NAN; //the axis never reaches that position on this arc.
+            }
+            constexpr double twoPi = 6.283185307179586;
+            double alpha = std::acos(c); //cos(angle) == c at angle = +/-alpha + 2*pi*k
+            double cur = phase + angularVel*t;
+            //the angle still to be swept (in the direction of motion) until each of the two solutions is next reached:
+            double d1 = angularVel > 0 ? alpha - cur : cur - alpha;
+            double d2 = angularVel > 0 ? -alpha - cur : cur + alpha;
+            d1 -= twoPi*std::floor(d1/twoPi);
+            d2 -= twoPi*std::floor(d2/twoPi);
+            return t + std::min(d1 > 0 ? d1 : twoPi, d2 > 0 ? d2 : twoPi) / std::fabs(angularVel);
+        }
         template <typename TupleT> void nextStep(TupleT &axes); //NOT TO BE OVERRIDEN
+        inline void _followExtrusionPath(const ExtrusionPath &/*path*/) {} //OVERRIDE THIS if the axis can be an extruder. Must recompute the first step of the move.
+        static inline float mechanicalPositionAt(float /*x*/, float /*y*/, float /*z*/, float /*e*/) { return NAN; } //OVERRIDE THIS if possible. Lets the MotionPlanner predict where a move will leave the axis (see mechanicalPositionsAt).
+        inline void sampleEndstop() {} //OVERRIDE THIS if the axis homes to an endstop. Should latch its state until the next step is computed.
     protected:
         void _nextStep(); //OVERRIDE THIS. Will be called upon initialization.
     public:
@@ -72,6 +146,10 @@ class AxisStepper {
             typedef std::tuple<typename Types::HomeStepperT...> HomeStepperTypes;
         };
         template <typename... Types> struct GetHomeStepperTypes<std::tuple<Types...> > : GetHomeStepperTypes<Types...> {};
+        //SupportsArcs<TupleT>::value is true if every AxisStepper in the tuple can follow an ArcPath.
+        template <typename TupleT> struct SupportsArcs;
+        //ReportsPositions<TupleT>::value is true if every AxisStepper in the tuple overrides mechanicalPositionAt (ie mechanicalPositionsAt gives no NaNs).
+        template <typename TupleT> struct ReportsPositions;
         
 };
 
@@ -82,14 +160,9 @@ template <typename TupleT, int idx> struct _AxisStepper__getNextTime {
     AxisStepper& operator()(TupleT &axes) {
         AxisStepper &m1 = _AxisStepper__getNextTime<TupleT, idx-1>()(axes);
         AxisStepper &m2 = std::get<idx>(axes);
-        //assume that .time can be finite, infinite, or NaN.
-        //comparisons against NaN are ALWAYS false.
-        if (m1.time <= 0) { return m2; } //if one of the times is non-positive (ie no next step), return the other one.
-        if (m2.time <= 0) { return m1; }
-        //Now return the smallest of the two, discarding any NaNs:
-        //if m2.time == NaN, then (m1.time < m2.time || isnan(m2.time)) ? m1 : m2 will return m1.time
-        //elif m1.time == NaN, then (m1.time < m2.time || isnan(m2.time)) ? m1 : m2 will return m2.time
-        return (m1.time < m2.time || std::isnan(m2.time)) ? m1 : m2;
+        //steppers with no next step report noStep(), which compares greater than any real step time.
+        //if both are equal, the later stepper is chosen.
+        return m1.time < m2.time ? m1 : m2;
     }
 };
 
@@ -106,43 +179,127 @@ template <typename TupleT> AxisStepper& AxisStepper::getNextTime(TupleT &axes) {
 //Helper classes for AxisStepper::initAxisSteppers
 
 template <typename TupleT, std::size_t MechSize, int idxPlusOne> struct _AxisStepper__initAxisSteppers {
-    void operator()(TupleT &steppers, const std::array<int, MechSize>& curPos, float vx, float vy, float vz, float ve) {
-        _AxisStepper__initAxisSteppers<TupleT, MechSize, idxPlusOne-1>()(steppers, curPos, vx, vy, vz, ve); //initialize all previous values.
-        std::get<idxPlusOne-1>(steppers) = typename std::tuple_element<idxPlusOne-1, TupleT>::type(idxPlusOne-1, curPos, vx, vy, vz, ve);
+    void operator()(TupleT &steppers, const std::array<int, MechSize>& curPos, float x0, float y0, float z0, float e0, float vx, float vy, float vz, float ve) {
+        _AxisStepper__initAxisSteppers<TupleT, MechSize, idxPlusOne-1>()(steppers, curPos, x0, y0, z0, e0, vx, vy, vz, ve); //initialize all previous values.
+        std::get<idxPlusOne-1>(steppers) = typename std::tuple_element<idxPlusOne-1, TupleT>::type(idxPlusOne-1, curPos, x0, y0, z0, e0, vx, vy, vz, ve);
         std::get<idxPlusOne-1>(steppers)._nextStep();
     }
 };
 
 template <typename TupleT, std::size_t MechSize> struct _AxisStepper__initAxisSteppers<TupleT, MechSize, 0> {
-    void operator()(TupleT &, const std::array<int, MechSize>&, float, float, float, float) {
+    void operator()(TupleT &, const std::array<int, MechSize>&, float, float, float, float, float, float, float, float) {
         //std::get<0>(steppers) = typename std::tuple_element<0, TupleT>::type(0, curPos, vx, vy, vz, ve);
         //std::get<0>(steppers)._nextStep();
     }
 };
 
-template <typename TupleT, std::size_t MechSize> void AxisStepper::initAxisSteppers(TupleT &steppers, const std::array<int, MechSize>& curPos, float vx, float vy, float vz, float ve) {
-    _AxisStepper__initAxisSteppers<TupleT, MechSize, std::tuple_size<TupleT>::value>()(steppers, curPos, vx, vy, vz, ve);
+template <typename TupleT, std::size_t MechSize> void AxisStepper::initAxisSteppers(TupleT &steppers, const std::array<int, MechSize>& curPos, float x0, float y0, float z0, float e0, float vx, float vy, float vz, float ve) {
+    _AxisStepper__initAxisSteppers<TupleT, MechSize, std::tuple_size<TupleT>::value>()(steppers, curPos, x0, y0, z0, e0, vx, vy, vz, ve);
+}
+
+//Helper classes for AxisStepper::initAxisArcSteppers
+
+template <typename TupleT, std::size_t MechSize, int idxPlusOne> struct _AxisStepper__initAxisArcSteppers {
+    void operator()(TupleT &steppers, const std::array<int, MechSize>& curPos, const ArcPath &arc) {
+        _AxisStepper__initAxisArcSteppers<TupleT, MechSize, idxPlusOne-1>()(steppers, curPos, arc); //initialize all previous values.
+        std::get<idxPlusOne-1>(steppers) = typename std::tuple_element<idxPlusOne-1, TupleT>::type(idxPlusOne-1, curPos, arc);
+        std::get<idxPlusOne-1>(steppers)._nextStep();
+    }
+};
+
+template <typename TupleT, std::size_t MechSize> struct _AxisStepper__initAxisArcSteppers<TupleT, MechSize, 0> {
+    void operator()(TupleT &, const std::array<int, MechSize>&, const ArcPath &) {}
+};
+
+template <typename TupleT, std::size_t MechSize> void AxisStepper::initAxisArcSteppers(TupleT &steppers, const std::array<int, MechSize>& curPos, const ArcPath &arc) {
+    _AxisStepper__initAxisArcSteppers<TupleT, MechSize, std::tuple_size<TupleT>::value>()(steppers, curPos, arc);
 }
 
+//Helper classes for AxisStepper::mechanicalPositionsAt
+
+template <typename TupleT, std::size_t MechSize, int idxPlusOne> struct _AxisStepper__mechanicalPositionsAt {
+    void operator()(std::array<float, MechSize> &pos, float x, float y, float z, float e) {
+        _AxisStepper__mechanicalPositionsAt<TupleT, MechSize, idxPlusOne-1>()(pos, x, y, z, e);
+        pos[idxPlusOne-1] = std::tuple_element<idxPlusOne-1, TupleT>::type::mechanicalPositionAt(x, y, z, e);
+    }
+};
+
+template <typename TupleT, std::size_t MechSize> struct _AxisStepper__mechanicalPositionsAt<TupleT, MechSize, 0> {
+    void operator()(std::array<float, MechSize> &, float, float, float, float) {}
+};
+
+template <typename TupleT, std::size_t MechSize> void AxisStepper::mechanicalPositionsAt(std::array<float, MechSize> &pos, float x, float y, float z, float e) {
+    _AxisStepper__mechanicalPositionsAt<TupleT, MechSize, std::tuple_size<TupleT>::value>()(pos, x, y, z, e);
+}
+
+//Helper classes for AxisStepper::SupportsArcs
+//(the size of the mechanical position array is irrelevant, as the arc constructors are templated on it)
+template <typename... Types> struct _AxisStepper__supportsArcs : std::true_type {};
+template <typename T, typename... Rest> struct _AxisStepper__supportsArcs<T, Rest...> : std::integral_constant<bool,
+    std::is_constructible<T, int, const std::array<int, 4>&, const ArcPath&>::value && _AxisStepper__supportsArcs<Rest...>::value> {};
+
+template <typename... Types> struct AxisStepper::SupportsArcs<std::tuple<Types...> > : _AxisStepper__supportsArcs<Types...> {};
+
+//Helper classes for AxisStepper::ReportsPositions
+template <typename... Types> struct _AxisStepper__reportsPositions : std::true_type {};
+template <typename T, typename... Rest> struct _AxisStepper__reportsPositions<T, Rest...> : std::integral_constant<bool,
+    (&T::mechanicalPositionAt != &AxisStepper::mechanicalPositionAt) && _AxisStepper__reportsPositions<Rest...>::value> {};
+
+template <typename... Types> struct AxisStepper::ReportsPositions<std::tuple<Types...> > : _AxisStepper__reportsPositions<Types...> {};
+
 //Helper classes for AxisStepper::initAxisHomeSteppers
 
 template <typename TupleT, int idxPlusOne> struct _AxisStepper__initAxisHomeSteppers {
-    void operator()(TupleT &steppers, float vHome) {
-        _AxisStepper__initAxisHomeSteppers<TupleT, idxPlusOne-1>()(steppers, vHome); //initialize all previous values.
-        std::get<idxPlusOne-1>(steppers) = typename std::tuple_element<idxPlusOne-1, TupleT>::type(idxPlusOne-1, vHome);
+    void operator()(TupleT &steppers, float vHome, float backOffDist) {
+        _AxisStepper__initAxisHomeSteppers<TupleT, idxPlusOne-1>()(steppers, vHome, backOffDist); //initialize all previous values.
+        std::get<idxPlusOne-1>(steppers) = typename std::tuple_element<idxPlusOne-1, TupleT>::type(idxPlusOne-1, vHome, backOffDist);
         std::get<idxPlusOne-1>(steppers)._nextStep();
     }
 };
 
 template <typename TupleT> struct _AxisStepper__initAxisHomeSteppers<TupleT, 0> {
-    void operator()(TupleT &, float) {
+    void operator()(TupleT &, float, float) {
         //std::get<0>(steppers) = typename std::tuple_element<0, TupleT>::type(0, vHome);
         //std::get<0>(steppers)._nextStep();
     }
 };
 
-template <typename TupleT> void AxisStepper::initAxisHomeSteppers(TupleT &steppers, float vHome) {
-    _AxisStepper__initAxisHomeSteppers<TupleT, std::tuple_size<TupleT>::value>()(steppers, vHome);
+template <typename TupleT> void AxisStepper::initAxisHomeSteppers(TupleT &steppers, float vHome, float backOffDist) {
+    _AxisStepper__initAxisHomeSteppers<TupleT, std::tuple_size<TupleT>::value>()(steppers, vHome, backOffDist);
+}
+
+//Helper classes for AxisStepper::sampleEndstops
+
+template <typename TupleT, int idxPlusOne> struct _AxisStepper__sampleEndstops {
+    void operator()(TupleT &steppers) {
+        _AxisStepper__sampleEndstops<TupleT, idxPlusOne-1>()(steppers);
+        std::get<idxPlusOne-1>(steppers).sampleEndstop();
+    }
+};
+
+template <typename TupleT> struct _AxisStepper__sampleEndstops<TupleT, 0> {
+    void operator()(TupleT &) {}
+};
+
+template <typename TupleT> void AxisStepper::sampleEndstops(TupleT &steppers) {
+    _AxisStepper__sampleEndstops<TupleT, std::tuple_size<TupleT>::value>()(steppers);
+}
+
+//Helper classes for AxisStepper::followExtrusionPath
+
+template <typename TupleT, int idxPlusOne> struct _AxisStepper__followExtrusionPath {
+    void operator()(TupleT &steppers, const ExtrusionPath &path) {
+        _AxisStepper__followExtrusionPath<TupleT, idxPlusOne-1>()(steppers, path);
+        std::get<idxPlusOne-1>(steppers)._followExtrusionPath(path);
+    }
+};
+
+template <typename TupleT> struct _AxisStepper__followExtrusionPath<TupleT, 0> {
+    void operator()(TupleT &, const ExtrusionPath &) {}
+};
+
+template <typename TupleT> void AxisStepper::followExtrusionPath(TupleT &steppers, const ExtrusionPath &path) {
+    _AxisStepper__followExtrusionPath<TupleT, std::tuple_size<TupleT>::value>()(steppers, path);
 }
 
 //Helper classes for AxisStepper::nextStep method
@@ -0,0 +1,188 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Colin Wallace
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Printipi/drivers/bedmesh.h
+ *
+ * A BedMesh corrects for a bed that isn't flat (or level) by offsetting z by an amount that varies over the bed.
+ * The offsets are probed at the nodes of a regular grid, and interpolated bilinearly between them.
+ * It's used by the CoordMaps (after any matrix Transform), in addition to the rigid leveling that the Transform provides.
+ *
+ * The grid is given at compile-time, in the same manner as matr::Matrix3Static:
+ *   BedMesh<X0_1000, Y0_1000, SPACING_1000, NX, NY, z00, z10, ..., z01, z11, ...>
+ *   where (X0, Y0) is the node with the smallest x and y, nodes are SPACING mm apart, and there are NX nodes in each row & NY rows.
+ *   Offsets are in micrometers, row by row (ie all nodes with y=Y0 first, in order of increasing x).
+ *   util/bedmesh.py formats a list of probed points as such.
+ * Outside the grid, the offset of the nearest point on its edge is used.
+ *
+ * Each cell of the grid is stored as the 4 coefficients of its bilinear function, so an offset is found from one contiguous 16-byte cell,
+ *   with no more than a multiply-add per coefficient.
+ *
+ * Because the offset is bilinear within a cell (and has a kink at each grid line), a straight move between two corrected points
+ *   doesn't follow the bed. splitFraction() tells the MotionPlanner how much of a move can be taken as a single straight segment,
+ *   such that it strays no more than BED_MESH_TOLERANCE from the corrected path. Moves are only broken at grid lines,
+ *   unless a single cell curves so much that even the part of the move within it must be divided.
+ */
+
+#ifndef DRIVERS_BEDMESH_H
+#define DRIVERS_BEDMESH_H
+
+#include <array>
+#include <cmath> //for fabs, sqrt, ceil
+#include <algorithm> //for min, max
+
+#ifndef BED_MESH_TOLERANCE
+    #define BED_MESH_TOLERANCE 0.005 //mm. A move is broken into several straight segments if taking it as one would stray further than this from the corrected path
+#endif
+
+namespace drv {
+
+//BedMesh that applies no correction:
+struct NoBedMesh {
+    static constexpr float offset(float /*x*/, float /*y*/) {
+        return 0;
+    }
+    static constexpr float splitFraction(float /*x0*/, float /*y0*/, float /*x1*/, float /*y1*/) {
+        return 1;
+    }
+};
+
+template <int X0_1000, int Y0_1000, unsigned SPACING_1000, unsigned NX, unsigned NY, int... Z_UM> class BedMesh {
+    static_assert(NX >= 2 && NY >= 2, "BedMesh needs at least 2x2 nodes");
+    static_assert(sizeof...(Z_UM) == NX*NY, "BedMesh must be given exactly NX*NY offsets");
+    static constexpr float X0 = X0_1000 / 1000.f;
+    static constexpr float Y0 = Y0_1000 / 1000.f;
+    static constexpr float SPACING = SPACING_1000 / 1000.f;
+    static constexpr float INV_SPACING = 1000.f / SPACING_1000;
+    static constexpr std::size_t MAX_BREAKS = NX + NY; //a straight line crosses each grid line at most once
+    //offset = a + b*u + c*v + d*u*v, where (u, v) in [0, 1] is the position within the cell:
+    struct Cell {
+        float a, b, c, d;
+    };
+    typedef std::array<Cell, (NX-1)*(NY-1)> Cells;
+    static const Cells _cells;
+    static Cells _computeCells() {
+        static const int z[] = {Z_UM...};
+        Cells cells;
+        for (unsigned j=0; j<NY-1; ++j) {
+            for (unsigned i=0; i<NX-1; ++i) {
+                float z00 = z[j*NX+i]*1e-3f, z10 = z[j*NX+i+1]*1e-3f;
+                float z01 = z[(j+1)*NX+i]*1e-3f, z11 = z[(j+1)*NX+i+1]*1e-3f;
+                Cell &cell = cells[j*(NX-1)+i];
+                cell.a = z00;
+                cell.b = z10 - z00;
+                cell.c = z01 - z00;
+                cell.d = z11 - z10 - z01 + z00;
+            }
+        }
+        return cells;
+    }
+    public:
+        //the z offset (mm) at (x, y):
+        static float offset(float x, float y) {
+            float gx = std::max(0.f, std::min((float)(NX-1), (x-X0)*INV_SPACING));
+            float gy = std::max(0.f, std::min((float)(NY-1), (y-Y0)*INV_SPACING));
+            unsigned i = std::min((unsigned)gx, NX-2);
+            unsigned j = std::min((unsigned)gy, NY-2);
+            float u = gx - i, v = gy - j;
+            const Cell &cell = _cells[j*(NX-1)+i];
+            return cell.a + u*(cell.b + v*cell.d) + v*cell.c;
+        }
+        //the fraction of the (uncorrected) line from (x0, y0) to (x1, y1) that may be taken as a single straight segment.
+        static float splitFraction(float x0, float y0, float x1, float y1) {
+            std::array<float, MAX_BREAKS> breaks;
+            std::size_t numBreaks = _findBreaks(x0, y0, x1, y1, breaks);
+            //extend the segment to each successive grid line, for as long as it stays within tolerance:
+            float accepted = 0;
+            for (std::size_t k=0; k<=numBreaks; ++k) {
+                float t = k < numBreaks ? breaks[k] : 1;
+                if (!_chordFits(x0, y0, x1, y1, breaks, k, t)) {
+                    break;
+                }
+                accepted = t;
+            }
+            if (accepted > 0) {
+                return accepted;
+            }
+            //the line bulges too far from its chord within the very first cell; the bulge is quadratic, so dividing the line in n reduces it n^2-fold.
+            float t = numBreaks ? breaks[0] : 1;
+            float err = std::fabs(_chordError(x0, y0, x1, y1, offset(x0, y0), t, 0.5f*t));
+            return t / std::ceil(std::sqrt(err / BED_MESH_TOLERANCE));
+        }
+    private:
+        static std::size_t _findBreaks(float x0, float y0, float x1, float y1, std::array<float, MAX_BREAKS> &breaks) {
+            //find the fractions of the line at which it crosses a grid line, in increasing order.
+            //Crossings within a micron of either end are ignored, so that a move that was split at a grid line doesn't produce a sliver on the next call.
+            std::array<float, NX> xBreaks;
+            std::array<float, NY> yBreaks;
+            float len = std::sqrt((x1-x0)*(x1-x0) + (y1-y0)*(y1-y0));
+            std::size_t numX = _findAxisBreaks<NX>(x0, x1, X0, len, xBreaks);
+            std::size_t numY = _findAxisBreaks<NY>(y0, y1, Y0, len, yBreaks);
+            std::merge(xBreaks.begin(), xBreaks.begin()+numX, yBreaks.begin(), yBreaks.begin()+numY, breaks.begin());
+            return numX + numY;
+        }
+        template <unsigned N> static std::size_t _findAxisBreaks(float a0, float a1, float gridStart, float len, std::array<float, N> &breaks) {
+            std::size_t numBreaks = 0;
+            if (a1 == a0) {
+                return 0;
+            }
+            for (unsigned m=0; m<N; ++m) {
+                unsigned node = a1 > a0 ? m : N-1-m; //visit the grid lines in the direction of travel
+                float t = (gridStart + node*SPACING - a0) / (a1 - a0);
+                if (t*len > 1e-3f && (1-t)*len > 1e-3f) {
+                    breaks[numBreaks++] = t;
+                }
+            }
+            return numBreaks;
+        }
+        static float _chordError(float x0, float y0, float x1, float y1, float z0, float end, float t) {
+            //distance by which the straight segment covering [0, end] of the line strays from the corrected path at t. z0 is the offset at (x0, y0).
+            float dx = x1-x0, dy = y1-y0;
+            float zEnd = offset(x0 + end*dx, y0 + end*dy);
+            return offset(x0 + t*dx, y0 + t*dy) - (z0 + (t/end)*(zEnd - z0));
+        }
+        static bool _chordFits(float x0, float y0, float x1, float y1, const std::array<float, MAX_BREAKS> &breaks, std::size_t numBreaks, float end) {
+            //the path is quadratic between grid lines, so it strays furthest from the chord either at a grid line, or near the middle of a cell
+            float z0 = offset(x0, y0);
+            float prev = 0;
+            for (std::size_t k=0; k<=numBreaks; ++k) {
+                float t = k < numBreaks ? breaks[k] : end;
+                if (std::fabs(_chordError(x0, y0, x1, y1, z0, end, 0.5f*(prev+t))) > BED_MESH_TOLERANCE) {
+                    return false;
+                }
+                if (k < numBreaks && std::fabs(_chordError(x0, y0, x1, y1, z0, end, t)) > BED_MESH_TOLERANCE) {
+                    return false;
+                }
+                prev = t;
+            }
+            return true;
+        }
+};
+
+template <int X0_1000, int Y0_1000, unsigned SPACING_1000, unsigned NX, unsigned NY, int... Z_UM>
+    const typename BedMesh<X0_1000, Y0_1000, SPACING_1000, NX, NY, Z_UM...>::Cells BedMesh<X0_1000, Y0_1000, SPACING_1000, NX, NY, Z_UM...>::_cells
+    = BedMesh<X0_1000, Y0_1000, SPACING_1000, NX, NY, Z_UM...>::_computeCells();
+
+}
+
+#endif
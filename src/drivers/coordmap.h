@@ -45,6 +45,13 @@ class CoordMap {
         //constexpr static std::size_t numAxis();
         //return the home position, in cartesian coordinates:
         //static constexpr std::array<int, 4> getHomePosition(const std::array<int, 4> &cur)
+        //correct cartesian coordinates for an unlevel bed (a rigid transform, so straight moves stay straight):
+        //static std::tuple<float, float, float> applyLeveling(const std::tuple<float, float, float> &xyz)
+        //return the z offset at the (leveled) point (x, y) for an uneven bed, and the fraction of a move that can be made in a straight line despite it (see bedmesh.h):
+        //static float meshOffset(float x, float y)
+        //static float meshSplitFraction(float x0, float y0, float x1, float y1)
+        //return the velocity of each mechanical axis (in mm/sec of that axis) when the effector at (x, y, z) moves with velocity (vx, vy, vz, ve):
+        //static std::array<float, N> mechanicalVelocity(const std::tuple<float, float, float> &xyz, const std::tuple<float, float, float, float> &velXyze)
 };
 
 }
@@ -43,6 +43,7 @@
 #include "common/typesettings/primitives.h" //for CelciusType
 #include "common/tupleutil.h"
 #include "event.h"
+#include "stepdiroutputs.h"
 #include "drivers/iopin.h" //for NoPin
 
 namespace drv {
@@ -54,6 +55,7 @@ class IODriver {
         inline bool isEventOutputSequenceable(const Event &) { return false; } //OVERRIDE THIS
         std::vector<OutputEvent> getEventOutputSequence(const Event &) { assert(false); } //OVERRIDE THIS if isEventOutputSequenceable returns true.
         NoPin getPwmPin() const { return NoPin(); } //OVERRIDE THIS if device is pwm-able.
+        StepDirOutputs getStepDirOutputs() const { return StepDirOutputs(); } //OVERRIDE THIS if the device's output sequence is that of a step/direction stepper driver (allows steps to be rasterized).
         inline void stepForward() {} //OVERRIDE THIS
         inline void stepBackward() {} //OVERRIDE THIS
         /*deactivate: called at program exit.
@@ -34,10 +34,11 @@
 
 #include "coordmap.h"
 #include "common/matrix.h"
+#include "bedmesh.h"
 
 namespace drv {
 
-template <typename Transform=matr::Identity3Static> class LinearCoordMap : public CoordMap {
+template <typename Transform=matr::Identity3Static, typename Mesh=NoBedMesh> class LinearCoordMap : public CoordMap {
     static constexpr std::size_t xIdx = 0;
     static constexpr std::size_t yIdx = 1;
     static constexpr std::size_t zIdx = 2;
@@ -53,12 +54,23 @@ template <typename Transform=matr::Identity3Static> class LinearCoordMap : publi
         static std::tuple<float, float, float> applyLeveling(const std::tuple<float, float, float> &xyz) {
             return Transform::transform(xyz);
         }
+        static float meshOffset(float x, float y) {
+            //z offset to apply at (x, y) (which have already been leveled) to account for an uneven bed
+            return Mesh::offset(x, y);
+        }
+        static float meshSplitFraction(float x0, float y0, float x1, float y1) {
+            //fraction of the move from (x0, y0) to (x1, y1) that may be taken in a straight line without straying from the bed mesh
+            return Mesh::splitFraction(x0, y0, x1, y1);
+        }
         static std::tuple<float, float, float, float> bound(const std::tuple<float, float, float, float> &xyze) {
             return xyze; //no bounding.
         }
         static std::tuple<float, float, float, float> xyzeFromMechanical(const std::array<int, 4> &mech) {
             return std::make_tuple(mech[xIdx], mech[yIdx], mech[zIdx], mech[eIdx]);
         }
+        static std::array<float, 4> mechanicalVelocity(const std::tuple<float, float, float> &/*xyz*/, const std::tuple<float, float, float, float> &velXyze) {
+            return std::array<float, 4>({{std::get<0>(velXyze), std::get<1>(velXyze), std::get<2>(velXyze), std::get<3>(velXyze)}});
+        }
 
 };
 
@@ -46,12 +46,20 @@
 #include "coordmap.h"
 #include "common/logging.h"
 #include "common/matrix.h"
+#include "bedmesh.h"
 #include <array>
 #include <tuple>
 
 namespace drv {
 
-template <unsigned R1000, unsigned L1000, unsigned H1000, unsigned BUILDRAD1000, unsigned STEPS_M, unsigned STEPS_M_EXT, typename Transform=matr::Identity3Static> class LinearDeltaCoordMap : public CoordMap {
+//xy position of each tower, for carriages r = R1000/1000 mm from the center.
+//tower A is at (0, r), B at (r*sqrt(3)/2, -r/2) and C at (-r*sqrt(3)/2, -r/2):
+template <unsigned R1000> struct LinearDeltaTowers {
+    static constexpr float x(std::size_t axisIdx) { return axisIdx == 0 ? 0 : (axisIdx == 1 ? R1000/1000.f*0.8660254037844386 : -(R1000/1000.f)*0.8660254037844386); } //sqrt(3)/2
+    static constexpr float y(std::size_t axisIdx) { return axisIdx == 0 ? R1000/1000.f : -(R1000/1000.f)/2; }
+};
+
+template <unsigned R1000, unsigned L1000, unsigned H1000, unsigned BUILDRAD1000, unsigned STEPS_M, unsigned STEPS_M_EXT, typename Transform=matr::Identity3Static, typename Mesh=NoBedMesh> class LinearDeltaCoordMap : public CoordMap {
     static constexpr std::size_t AIdx = 0;
     static constexpr std::size_t BIdx = 1;
     static constexpr std::size_t CIdx = 2;
@@ -76,6 +84,14 @@ template <unsigned R1000, unsigned L1000, unsigned H1000, unsigned BUILDRAD1000,
         static std::tuple<float, float, float> applyLeveling(const std::tuple<float, float, float> &xyz) {
             return Transform::transform(xyz);
         }
+        static float meshOffset(float x, float y) {
+            //z offset to apply at (x, y) (which have already been leveled) to account for an uneven bed
+            return Mesh::offset(x, y);
+        }
+        static float meshSplitFraction(float x0, float y0, float x1, float y1) {
+            //fraction of the move from (x0, y0) to (x1, y1) that may be taken in a straight line without straying from the bed mesh
+            return Mesh::splitFraction(x0, y0, x1, y1);
+        }
         static std::tuple<float, float, float, float> bound(const std::tuple<float, float, float, float> &xyze) {
             //bound z:
             float z = std::max(MIN_Z(), std::min((float)((h+sqrt(L*L-r*r))*STEPS_MM), std::get<2>(xyze)));
@@ -134,6 +150,21 @@ template <unsigned R1000, unsigned L1000, unsigned H1000, unsigned BUILDRAD1000,
             }
             return std::make_tuple(x, y, z, e);
         }
+        static std::array<float, 4> mechanicalVelocity(const std::tuple<float, float, float> &xyz, const std::tuple<float, float, float, float> &velXyze) {
+            //Each carriage is at height z + sqrt(L^2 - (x-towerX)^2 - (y-towerY)^2), so its velocity is
+            //  vz - ((x-towerX)*vx + (y-towerY)*vy) / sqrt(L^2 - (x-towerX)^2 - (y-towerY)^2)
+            //The carriages therefore move much faster than the effector when it travels toward or away from a tower near the edge of the build plate.
+            float x, y, vx, vy, vz, ve;
+            std::tie(x, y, std::ignore) = xyz;
+            std::tie(vx, vy, vz, ve) = velXyze;
+            std::array<float, 4> vel;
+            for (int i=0; i<3; ++i) {
+                float dx = x - LinearDeltaTowers<R1000>::x(i), dy = y - LinearDeltaTowers<R1000>::y(i);
+                vel[i] = vz - (dx*vx + dy*vy)/sqrt(L*L - dx*dx - dy*dy);
+            }
+            vel[EIdx] = ve;
+            return vel;
+        }
 
 };
 
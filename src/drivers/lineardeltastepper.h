@@ -25,6 +25,13 @@
  * Printipi/drivers/lineardeltastepper.h
  * 
  * LinearDeltaStepper implements the AxisStepper interface for (rail-based) Delta-style robots like the Kossel
+ *
+ * It also supports arcs in the XY plane. The squared horizontal distance from a tower to a point on the arc is
+ *   radius^2 + d^2 + 2*radius*d*cos(angle - towerAngle), where d is the distance from the tower to the arc center & towerAngle is the direction from the tower to the center,
+ *   so the angle at which the carriage reaches a given height can be solved for directly with an acos.
+ * For helical arcs (z changes too), there is no closed-form solution. Instead, the carriage height is expanded to second order about the time of the last step,
+ *   and the resulting quadratic solved and then polished with LINEARDELTASTEPPER_HELIX_ITERATIONS Newton iterations against the exact height.
+ *   The expansion is only trusted over a short window of the arc (HELIX_WINDOW radians), so that a step can't be skipped. If no step falls within the window, the next window is tried.
  */
 
 /*
@@ -48,41 +55,60 @@
 #include "axisstepper.h"
 #include "linearstepper.h" //for LinearHomeStepper
 #include "endstop.h"
+#include "lineardeltacoordmap.h" //for LinearDeltaTowers
+
+#ifndef LINEARDELTASTEPPER_HELIX_ITERATIONS
+    #define LINEARDELTASTEPPER_HELIX_ITERATIONS 2 //number of Newton refinements to the step time when following a helical arc. Each costs a sin, cos & sqrt.
+#endif
 
 namespace drv {
 
 template <std::size_t AxisIdx, typename CoordMap, unsigned R1000, unsigned L1000, unsigned STEPS_M, typename EndstopT=EndstopNoExist> class LinearDeltaStepper : public AxisStepper {
     private:
-        float M0; //initial coordinate of THIS axis.
+        double M0; //initial coordinate of THIS axis.
         int sTotal;
         //float x0, y0, z0;
         //float vx, vy, vz;
         //float v2; //squared velocity.
-        float inv_v2;
-        float vz_over_v2;
-        float _almostTerm1; //used for caching & reducing computational complexity inside nextStep()
-        float _almostRootParam;
-        float _almostRootParamV2S;
-        static constexpr float r() { return R1000 / 1000.; }
-        static constexpr float L() { return L1000 / 1000.; }
-        static constexpr float STEPS_MM() { return STEPS_M / 1000.; }
-        static constexpr float MM_STEPS() { return  1. / STEPS_MM(); }
+        //The linear solve is done in double: the step time is found as the small difference of term1 & root, which in float is only good to ~1e-7 of the move's duration.
+        double inv_v2;
+        double vz_over_v2;
+        double _almostTerm1; //used for caching & reducing computational complexity inside nextStep()
+        double _almostRootParam;
+        double _almostRootParamV2S;
+        double _time; //time of the next step, in seconds. The kinematics are solved in floating point, and the result converted to this->time
+        //only used when following an arc:
+        bool _isArc;
+        float _arcB, _arcK; //the squared height of the carriage above the effector is _arcK - _arcB*cos(_arcPhase + _angularVel*t)
+        float _arcPhase; //startAngle - towerAngle
+        float _angularVel;
+        float _z0, _vz;
+        static constexpr double r() { return R1000 / 1000.; }
+        static constexpr double L() { return L1000 / 1000.; }
+        static constexpr double STEPS_MM() { return STEPS_M / 1000.; }
+        static constexpr double MM_STEPS() { return  1. / STEPS_MM(); }
+        static constexpr float TOWER_X() { return LinearDeltaTowers<R1000>::x(AxisIdx); }
+        static constexpr float TOWER_Y() { return LinearDeltaTowers<R1000>::y(AxisIdx); }
     public:
         typedef LinearHomeStepper<STEPS_M, EndstopT> HomeStepperT;
         LinearDeltaStepper() {}
-        template <std::size_t sz> LinearDeltaStepper(int idx, const std::array<int, sz>& curPos, float vx, float vy, float vz, float ve)
-            : AxisStepper(idx, curPos, vx, vy, vz, ve),
+        static float mechanicalPositionAt(float x, float y, float z, float /*e*/) {
+            //the carriage sits L above the effector, less however far L is leaned over to reach it:
+            float dx = x - TOWER_X(), dy = y - TOWER_Y();
+            return (z + std::sqrt(L()*L() - dx*dx - dy*dy))*STEPS_MM();
+        }
+        template <std::size_t sz> LinearDeltaStepper(int idx, const std::array<int, sz>& curPos, double x0, double y0, double z0, float /*e0*/, double vx, double vy, double vz, float ve)
+            : AxisStepper(idx, curPos, x0, y0, z0, 0, vx, vy, vz, ve),
              M0(curPos[AxisIdx]*MM_STEPS()), 
              sTotal(0),
              //vx(vx), vy(vy), vz(vz),
              //v2(vx*vx + vy*vy + vz*vz), 
              inv_v2(1/(vx*vx + vy*vy + vz*vz)),
-             vz_over_v2(vz*inv_v2) {
+             vz_over_v2(vz*inv_v2),
+             _isArc(false) {
                 static_assert(AxisIdx < 3, "LinearDeltaStepper only supports axis A, B, or C (0, 1, 2)");
-                this->time = 0; //this may NOT be zero-initialized by parent.
-                float x0, y0, z0, e_;
-                //CoordMap::xyzeFromMechanical(curPos, this->x0, this->y0, this->z0, e_);
-                std::tie(x0, y0, z0, e_) = CoordMap::xyzeFromMechanical(curPos);
+                this->time = StepTimeT::zero(); //this may NOT be zero-initialized by parent.
+                this->_time = 0;
                 //precompute as much as possible:
                 _almostRootParamV2S = 2*M0 - 2*z0;
                 if (AxisIdx == 0) {
@@ -104,7 +130,25 @@ template <std::size_t AxisIdx, typename CoordMap, unsigned R1000, unsigned L1000
                     //_almostRootParamV2S = 2*M0 - 2*z0;
                 }
             }
-        void getTerm1AndRootParam(float &term1, float &rootParam, float s) {
+        template <std::size_t sz> LinearDeltaStepper(int idx, const std::array<int, sz>& curPos, const ArcPath &arc)
+            : AxisStepper(idx, curPos, arc),
+             M0(curPos[AxisIdx]*MM_STEPS()),
+             sTotal(0),
+             _isArc(true),
+             _angularVel(arc.angularVel),
+             _vz(arc.vz) {
+                static_assert(AxisIdx < 3, "LinearDeltaStepper only supports axis A, B, or C (0, 1, 2)");
+                this->time = StepTimeT::zero();
+                this->_time = 0;
+                _z0 = arc.z0;
+                float dx = arc.centerX - TOWER_X();
+                float dy = arc.centerY - TOWER_Y();
+                float d2 = dx*dx + dy*dy;
+                _arcB = 2*arc.radius*std::sqrt(d2);
+                _arcK = L()*L() - arc.radius*arc.radius - d2;
+                _arcPhase = arc.startAngle - std::atan2(dy, dx);
+            }
+        void getTerm1AndRootParam(double &term1, double &rootParam, double s) {
             //Therefore, we should cache values calculatable at init-time, like all of the second-half on rootParam.
             term1 = _almostTerm1 + vz_over_v2*s;
             rootParam = term1*term1 + _almostRootParam - inv_v2*s*(_almostRootParamV2S + s);
@@ -122,8 +166,8 @@ template <std::size_t AxisIdx, typename CoordMap, unsigned R1000, unsigned L1000
             float t1 = (term1 - root)/v2;
             float t2 = (term1 + root)/v2;*/
         }
-        float testDir(float s) {
-            float term1, rootParam;
+        double testDir(double s) {
+            double term1, rootParam;
             getTerm1AndRootParam(term1, rootParam, s);
             if (rootParam < 0) {
                 return NAN;
@@ -134,54 +178,119 @@ template <std::size_t AxisIdx, typename CoordMap, unsigned R1000, unsigned L1000
             //float root = std::sqrt(rootParam/v2/v2);
             //float t1 = term1/v2 - root;
             //float t2 = term1/v2 + root;
-            float root = std::sqrt(rootParam);
-            float t1 = term1 - root;
-            float t2 = term1 + root;
+            double root = std::sqrt(rootParam);
+            double t1 = term1 - root;
+            double t2 = term1 + root;
             //LOGV("LinearDeltaStepper<%zu>::testDir(%f) times %f, %f\n", AxisIdx, s, t1, t2);
             if (root > term1) { //if this is true, then t1 MUST be negative.
                 //return t2 if t2 > 0 else None
                 //return t2 > 0 ? t2 : NAN;
-                return t2 > time ? t2 : NAN;
+                return t2 > _time ? t2 : NAN;
             } else {
                 //return t1;
-                return t1 > time ? t1 : (t2 > time ? t2 : NAN); //ensure no value < time is returned.
+                return t1 > _time ? t1 : (t2 > _time ? t2 : NAN); //ensure no value < time is returned.
+            }
+        }
+        static constexpr float HELIX_WINDOW() { return 0.1; } //radians. Over this much of the arc, the error of the quadratic expansion is a small fraction of a step.
+        double _planarArcTime(float M) {
+            //the earliest time after _time at which the carriage is at height M (for arcs in which z is constant).
+            float dz = M - _z0;
+            if (dz < 0) { //the carriage is always above the effector
+                return NAN;
             }
+            return arcTimeOfCos((_arcK - dz*dz)/_arcB, _arcPhase, _angularVel, _time);
+        }
+        void _helixHeight(double t, float &h, float &dh, float &ddh) {
+            //the carriage height at time t, and its first & second time derivatives
+            double angle = _arcPhase + _angularVel*t;
+            float cosA = std::cos(angle);
+            float sinA = std::sin(angle);
+            float q = _arcK - _arcB*cosA; //squared height of the carriage above the effector
+            float g = std::sqrt(q);
+            float dq = _arcB*_angularVel*sinA;
+            float ddq = _arcB*_angularVel*_angularVel*cosA;
+            h = _z0 + _vz*t + g;
+            dh = _vz + dq/(2*g);
+            ddh = ddq/(2*g) - dq*dq/(4*g*q);
+        }
+        double _helixTime(float M) {
+            //the earliest time after _time at which the carriage is at height M (for helical arcs).
+            //Only the offset within a window is solved in float; the time itself is accumulated in double.
+            double window = HELIX_WINDOW() / std::fabs(_angularVel);
+            int numWindows = (int)(6.283185307179586 / HELIX_WINDOW()) + 1; //give up after a full revolution without reaching M.
+            double t0 = _time;
+            for (int w=0; w<numWindows; ++w, t0 += window) {
+                float h, dh, ddh;
+                _helixHeight(t0, h, dh, ddh);
+                //earliest root in (0, window] of h + dh*dt + ddh/2*dt^2 == M:
+                float a = 0.5f*ddh, b = dh, c = h - M;
+                double dt = NAN;
+                if (std::fabs(a*window) < 1e-6f*std::fabs(b)) {
+                    dt = -c/b;
+                } else {
+                    float disc = b*b - 4*a*c;
+                    if (disc >= 0) {
+                        float q = -0.5f*(b + std::copysign(std::sqrt(disc), b));
+                        float r1 = q/a, r2 = c/q;
+                        dt = std::min(r1 > 0 ? r1 : INFINITY, r2 > 0 ? r2 : INFINITY);
+                    }
+                }
+                if (!(dt > 0 && dt <= window)) {
+                    continue; //M isn't reached within this window.
+                }
+                //polish the root against the exact height:
+                double t = t0 + dt;
+                for (int i=0; i<LINEARDELTASTEPPER_HELIX_ITERATIONS; ++i) {
+                    _helixHeight(t, h, dh, ddh);
+                    double refined = t - (h - M)/dh;
+                    if (!(refined > t0 && refined <= t0 + 2*window)) {
+                        break; //Newton's method diverged (the path is tangent to M); stick with the estimate.
+                    }
+                    t = refined;
+                }
+                return t;
+            }
+            return NAN;
+        }
+        double testArc(float s) {
+            return _vz ? _helixTime(M0 + s) : _planarArcTime(M0 + s);
         }
         void _nextStep() {
-            float negTime = testDir((sTotal-1)*MM_STEPS()); //get the time at which next steps would occur.
-            float posTime = testDir((sTotal+1)*MM_STEPS());
-            //LOGV("LinearDeltaStepper<%zu>::neg/pos/cur-time %f, %f, %f\n", AxisIdx, negTime, posTime, time);
-            if (negTime < time || std::isnan(negTime)) { //negTime is invalid
-                if (posTime > time) {
+            double negTime = _isArc ? testArc((sTotal-1)*MM_STEPS()) : testDir((sTotal-1)*MM_STEPS()); //get the time at which next steps would occur.
+            double posTime = _isArc ? testArc((sTotal+1)*MM_STEPS()) : testDir((sTotal+1)*MM_STEPS());
+            //LOGV("LinearDeltaStepper<%zu>::neg/pos/cur-time %f, %f, %f\n", AxisIdx, negTime, posTime, _time);
+            if (negTime < _time || std::isnan(negTime)) { //negTime is invalid
+                if (posTime > _time) {
                     //LOGV("LinearDeltaStepper<%zu>::chose %f (pos)\n", AxisIdx, posTime);
-                    this->time = posTime;
+                    _time = posTime;
                     this->direction = StepForward;
                     ++sTotal;
                 } else {
-                    this->time = NAN;
+                    _time = NAN;
                 }
-            } else if (posTime < time || std::isnan(posTime)) { //posTime is invalid
-                if (negTime > time) {
+            } else if (posTime < _time || std::isnan(posTime)) { //posTime is invalid
+                if (negTime > _time) {
                     //LOGV("LinearDeltaStepper<%zu>::chose %f (neg)\n", AxisIdx, negTime);
-                    this->time = negTime;
+                    _time = negTime;
                     this->direction = StepBackward;
                     --sTotal;
                 } else {
-                    this->time = NAN;
+                    _time = NAN;
                 }
             } else { //neither time is invalid
                 if (negTime < posTime) {
                     //LOGV("LinearDeltaStepper<%zu>::chose %f (neg)\n", AxisIdx, negTime);
-                    this->time = negTime;
+                    _time = negTime;
                     this->direction = StepBackward;
                     --sTotal;
                 } else {
                     //LOGV("LinearDeltaStepper<%zu>::chose %f (pos)\n", AxisIdx, posTime);
-                    this->time = posTime;
+                    _time = posTime;
                     this->direction = StepForward;
                     ++sTotal;
                 }
             }
+            this->time = timeFromSeconds(_time);
         }
 };
 
@@ -25,7 +25,12 @@
  * Printipi/drivers/linearstepper.h
  * 
  * LinearStepper implements the AxisStepper interface for Cartesian-style robots.
+ * It also supports arcs in the XY plane: the X and Y steppers then solve x = centerX + radius*cos(angle) (or the equivalent for y) for the time of each step.
+ * An extruder (COORD_E) may instead be made to follow an ExtrusionPath, eg for pressure advance.
+ * Steps are taken wherever the path crosses a whole step, counted from the mechanical position. The path begins from the commanded position,
+ *   which may be up to a step away from the mechanical one (eg if the previous move ended partway between steps), so any rounding doesn't accumulate over many short moves.
  * Additionally, the LinearHomeStepper is used to home the axis for some other types of robots.
+ *   It can also back the axis off of its endstop by a fixed distance, so that the endstop can be approached a second time more slowly.
  */
  
 
@@ -38,27 +43,45 @@
 #include "common/logging.h"
 #include <tuple>
 #include <cmath> //for fabs
+#include <algorithm> //for min, max
 
 namespace drv {
 
 template <int STEPS_M, typename EndstopT> class LinearHomeStepper : public AxisStepper {
     EndstopT endstop;
-    float timePerStep;
+    double nsPerStep;
+    int64_t stepsTaken;
+    bool isBackingOff; //true if the axis is moving away from the endstop (by backOffSteps), rather than homing to it
+    int64_t backOffSteps;
+    bool isTriggered; //latched once the endstop has been seen to be triggered, whether by sampleEndstop or when computing a step
     static constexpr float STEPS_MM = STEPS_M / 1000.;
     public:
         LinearHomeStepper() {}
-        LinearHomeStepper(int idx, float vHome) : AxisStepper(idx, vHome) {
-            this->time = 0;
-            this->direction = StepForward;
-            this->timePerStep = 1./ (vHome*STEPS_MM);
+        LinearHomeStepper(int idx, float vHome, float backOffDist=0) : AxisStepper(idx, vHome) {
+            this->time = StepTimeT::zero();
+            this->isBackingOff = backOffDist > 0;
+            this->direction = isBackingOff ? StepBackward : StepForward;
+            this->nsPerStep = 1e9/ (vHome*STEPS_MM);
+            this->stepsTaken = 0;
+            this->backOffSteps = isBackingOff ? (int64_t)(backOffDist*STEPS_MM + 0.5) : 0;
+            this->isTriggered = false;
+        }
+        void sampleEndstop() {
+            isTriggered = isTriggered || endstop.isTriggered();
         }
         
         void _nextStep() {
-            //if (EndstopT::isTriggered()) {
-            if (endstop.isTriggered()) {
-                this->time = NAN; //at endstop; no more steps.
+            if (isBackingOff) {
+                //the endstop is still triggered for the first part of the back-off, so it's ignored.
+                this->time = stepsTaken < backOffSteps ? StepTimeT((StepTimeT::rep)(++stepsTaken * nsPerStep)) : noStep();
+                return;
+            }
+            sampleEndstop();
+            if (isTriggered) {
+                this->time = noStep(); //at endstop; no more steps.
             } else {
-                this->time += timePerStep;
+                //step n occurs at exactly n*nsPerStep, rather than accumulating rounding errors.
+                this->time = StepTimeT((StepTimeT::rep)(++stepsTaken * nsPerStep));
             }
         }
 };
@@ -66,16 +89,32 @@ template <int STEPS_M, typename EndstopT> class LinearHomeStepper : public AxisS
 template <int STEPS_M> class LinearHomeStepper<STEPS_M, EndstopNoExist> : public AxisStepper {
     public:
         LinearHomeStepper() {}
-        LinearHomeStepper(int idx, float vHome) : AxisStepper(idx, vHome) {
-            this->time = NAN; //device isn't homeable, so never step.
+        LinearHomeStepper(int idx, float vHome, float /*backOffDist*/=0) : AxisStepper(idx, vHome) {
+            this->time = noStep(); //device isn't homeable, so never step.
         }
         void _nextStep() {}
 };
 
 template <int STEPS_PER_METER, CoordAxis CoordType, typename EndstopT=EndstopNoExist> class LinearStepper : public AxisStepper {
     private:
-        float timePerStep;
+        double nsPerStep; //0 if this axis doesn't move
+        int64_t stepsTaken; //when following an arc, this is the (signed) number of steps from the start position.
+        float _startFrac; //the commanded position at the start of the move, in steps relative to the mechanical position.
+        //only used for X & Y when following an arc:
+        float _arcStepScale; //the change in cos(angle) for each step, or 0 if this axis is moving linearly
+        float _arcPhase; //the axis' position relative to the arc center is radius*cos(_arcPhase + _angularVel*t)
+        float _arcCos0; //cos(_arcPhase)
+        float _angularVel;
+        double _time; //time of the current step, in seconds
+        //only used for E when following an ExtrusionPath:
+        const ExtrusionPath *_extrusionPath; //null if the axis moves at the velocity it was initialized with
+        std::size_t _pathSample; //the step lies between samples _pathSample and _pathSample+1 of the path
         static constexpr float STEPS_MM = STEPS_PER_METER/1000.0;
+        template <std::size_t sz> static float _findStartFrac(int idx, const std::array<int, sz>& curPos, float coord) {
+            //The axis may lag behind (or lead) the commanded position by up to about a step. It is limited to just under a step, so that the first step is never due before the move begins.
+            float frac = (double)coord*STEPS_MM - curPos[idx];
+            return std::max(-0.99f, std::min(0.99f, frac));
+        }
     public:
         typedef LinearHomeStepper<STEPS_PER_METER, EndstopT> HomeStepperT;
         static constexpr float GET_COORD(float x, float y, float z, float e) {
@@ -93,16 +132,100 @@ template <int STEPS_PER_METER, CoordAxis CoordType, typename EndstopT=EndstopNoE
             //NOTE: this may return a NEGATIVE time, indicating that the stepping direction is backward.
             return 1./ (GET_COORD(vx, vy, vz, ve) * STEPS_MM);
         }
+        static float mechanicalPositionAt(float x, float y, float z, float e) {
+            return (double)GET_COORD(x, y, z, e)*STEPS_MM;
+        }
         LinearStepper() {}
-        template <std::size_t sz> LinearStepper(int idx, const std::array<int, sz>& curPos, float vx, float vy, float vz, float ve)
-            : AxisStepper(idx, curPos, vx, vy, vz, ve),
-            timePerStep(std::fabs( TIME_PER_STEP(vx, vy, vz, ve) )) {
-                this->time = 0;
+        template <std::size_t sz> LinearStepper(int idx, const std::array<int, sz>& curPos, float x0, float y0, float z0, float e0, float vx, float vy, float vz, float ve)
+            : AxisStepper(idx, curPos, x0, y0, z0, e0, vx, vy, vz, ve),
+            nsPerStep(1e9*std::fabs( TIME_PER_STEP(vx, vy, vz, ve) )),
+            stepsTaken(0),
+            _startFrac(_findStartFrac(idx, curPos, GET_COORD(x0, y0, z0, e0))),
+            _arcStepScale(0),
+            _extrusionPath(nullptr) {
+                if (!(nsPerStep < 1e18)) { //infinite (or NaN) time per step means this axis isn't moving.
+                    nsPerStep = 0;
+                }
+                this->time = StepTimeT::zero();
                 this->direction = stepDirFromSign( TIME_PER_STEP(vx, vy, vz, ve) );
             }
+        template <std::size_t sz> LinearStepper(int idx, const std::array<int, sz>& curPos, const ArcPath &arc)
+            : AxisStepper(idx, curPos, arc),
+            nsPerStep(1e9*std::fabs( TIME_PER_STEP(0, 0, arc.vz, arc.ve) )), //Z & E still move linearly
+            stepsTaken(0),
+            _startFrac(_findStartFrac(idx, curPos, GET_COORD(arc.centerX + arc.radius*std::cos(arc.startAngle), arc.centerY + arc.radius*std::sin(arc.startAngle), arc.z0, arc.e0))),
+            _arcStepScale(CoordType==COORD_X || CoordType==COORD_Y ? 1./(STEPS_MM*arc.radius) : 0),
+            _arcPhase(CoordType==COORD_Y ? arc.startAngle - 1.5707963267948966f : arc.startAngle), //sin(a) = cos(a - pi/2)
+            _arcCos0(std::cos(_arcPhase)),
+            _angularVel(arc.angularVel),
+            _time(0),
+            _extrusionPath(nullptr) {
+                if (!(nsPerStep < 1e18)) {
+                    nsPerStep = 0;
+                }
+                this->time = StepTimeT::zero();
+                this->direction = stepDirFromSign( TIME_PER_STEP(0, 0, arc.vz, arc.ve) );
+            }
+        void _followExtrusionPath(const ExtrusionPath &path) {
+            if (CoordType != COORD_E) {
+                return;
+            }
+            _extrusionPath = &path;
+            _pathSample = 0;
+            stepsTaken = 0;
+            this->direction = stepDirFromSign(path.dist.back());
+            _nextStep();
+        }
         void _nextStep() {
-            this->time += timePerStep;
-            //LOG("LinearStepper::_nextStep() %i, %f\n", CoordType, timePerStep);
+            if (_extrusionPath) {
+                _nextPathStep();
+                return;
+            }
+            if (_arcStepScale) {
+                _nextArcStep();
+                return;
+            }
+            //step n occurs at exactly (n - _startFrac)*nsPerStep, rather than accumulating rounding errors (which grow as the move progresses).
+            double startOffset = this->direction == StepForward ? _startFrac : -_startFrac;
+            this->time = nsPerStep ? StepTimeT((StepTimeT::rep)((++stepsTaken - startOffset) * nsPerStep)) : noStep();
+            //LOG("LinearStepper::_nextStep() %i, %f\n", CoordType, nsPerStep);
+        }
+    private:
+        void _nextPathStep() {
+            //find where the path reaches the next step (in the direction of travel), & interpolate its time.
+            //Steps are taken in order, so the search resumes from the sample pair that held the previous step.
+            const ExtrusionPath &path = *_extrusionPath;
+            float sign = this->direction == StepForward ? 1 : -1;
+            float target = (++stepsTaken - sign*_startFrac)/STEPS_MM;
+            while (_pathSample+1 < path.dist.size() && sign*path.dist[_pathSample+1] < target) {
+                ++_pathSample;
+            }
+            if (_pathSample+1 >= path.dist.size()) {
+                this->time = noStep(); //the path ends before reaching the next step.
+                return;
+            }
+            float d0 = sign*path.dist[_pathSample], d1 = sign*path.dist[_pathSample+1];
+            float t0 = path.time[_pathSample], t1 = path.time[_pathSample+1];
+            this->time = timeFromSeconds(t0 + (t1-t0)*(target-d0)/(d1-d0));
+        }
+        void _nextArcStep() {
+            //the axis may reverse direction partway through the arc, so find when it would reach the positions one step either side of it & take the earlier.
+            double negTime = arcTimeOfCos(_arcCos0 + (stepsTaken-1-_startFrac)*_arcStepScale, _arcPhase, _angularVel, _time);
+            double posTime = arcTimeOfCos(_arcCos0 + (stepsTaken+1-_startFrac)*_arcStepScale, _arcPhase, _angularVel, _time);
+            if (std::isnan(negTime) && std::isnan(posTime)) {
+                this->time = noStep();
+                return;
+            }
+            if (std::isnan(posTime) || negTime < posTime) {
+                _time = negTime;
+                this->direction = StepBackward;
+                --stepsTaken;
+            } else {
+                _time = posTime;
+                this->direction = StepForward;
+                ++stepsTaken;
+            }
+            this->time = timeFromSeconds(_time);
         }
 };
 
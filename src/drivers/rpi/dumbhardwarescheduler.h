@@ -35,6 +35,7 @@
 #define DRIVERS_RPI_DUMBHARDWARESCHEDULER_H
 
 #include "outputevent.h"
+#include "stepdiroutputs.h"
 #include "mitpi.h"
 #include "drivers/auto/chronoclock.h" //for EventClockT
 
@@ -50,6 +51,23 @@ class DumbHardwareScheduler {
             //assert(false);
             mitpi::setPinState(e.pinId(), e.state());
         }
+        inline std::size_t queueBatch(const OutputEvent *evts, std::size_t num) {
+            //outputs are written immediately, so stop at the first event that isn't due yet
+            auto horizon = writableHorizon();
+            std::size_t i = 0;
+            for (; i<num && evts[i].time() <= horizon; ++i) {
+                queue(evts[i]);
+            }
+            return i;
+        }
+        static constexpr std::size_t maxRasterizedAxes() {
+            return 0;
+        }
+        inline void setStepDirOutputs(AxisIdType /*axis*/, const StepDirOutputs &/*outputs*/) {}
+        inline std::size_t queueSteps(const Event * /*steps*/, std::size_t /*num*/) {
+            assert(false); //DumbHardwareScheduler cannot queueSteps
+            return 0;
+        }
         inline void queuePwm(int /*pin*/, float /*ratio*/, float /*maxPeriod*/) {
             //Set the given pin to a pwm duty-cycle of `ratio` using a maximum period of maxPeriod (irrelevant if using PCM algorithm). Eg queuePwm(5, 0.4) sets pin #5 to a 40% duty cycle.
             //assert(false); //DefaultSchedulerInterface::HardwareScheduler cannot queuePwm!
@@ -59,6 +77,10 @@ class DumbHardwareScheduler {
             //If an event needs to occur at evtTime, this function should return the earliest time at which it can be scheduled.
             return evtTime;
         }
+        inline EventClockT::time_point writableHorizon() const {
+            //events up to this time can currently be queued without waiting
+            return EventClockT::now();
+        }
 };
 
 }
@@ -13,6 +13,7 @@
 #include <chrono>
 
 #include "schedulerbase.h"
+#include "event.h"
 #include "common/logging.h"
 #include "drivers/auto/thisthreadsleep.h" //for SleepT 
 #include "common/typesettings/compileflags.h" //for RUNNING_IN_VM
@@ -350,7 +351,11 @@ void HardwareScheduler::queue(int pin, int mode, uint64_t micros) {
     //Sleep until we are on the right iteration of the circular buffer (otherwise we cannot queue the command)
     uint64_t desiredTime = micros - MAX_SCHED_AHEAD_USEC;
     SleepT::sleep_until(std::chrono::time_point<std::chrono::microseconds>(std::chrono::microseconds(desiredTime)));
+    writeFrame(pin, mode, micros);
+}
 
+void HardwareScheduler::writeFrame(int pin, int mode, uint64_t micros) {
+    //Write the pin change into the frame for time `micros`, which must be no more than MAX_SCHED_AHEAD_USEC in the future.
     int64_t lastUsecAtFrame0 = _lastTimeAtFrame0;
     int usecFromFrame0 = micros - lastUsecAtFrame0;
     if (usecFromFrame0 < 0) { //need this check to prevent newIdx from being negative.
@@ -374,6 +379,142 @@ void HardwareScheduler::queue(int pin, int mode, uint64_t micros) {
     }
 }
 
+//set/clear bits destined for a single frame, so that several writes to that (uncached) frame can be merged into one.
+struct GpioFrameBits {
+    uint32_t gpset[NUM_GPIO_WORDS];
+    uint32_t gpclr[NUM_GPIO_WORDS];
+    GpioFrameBits() : gpset(), gpclr() {}
+    void flushInto(GpioBufferFrame &frame) {
+        for (int w=0; w<NUM_GPIO_WORDS; ++w) {
+            if (gpset[w]) {
+                frame.gpset[w] |= gpset[w];
+                gpset[w] = 0;
+            }
+            if (gpclr[w]) {
+                frame.gpclr[w] |= gpclr[w];
+                gpclr[w] = 0;
+            }
+        }
+    }
+};
+
+//Maps times (in uS since frame 0) onto frames, but only does the division when a time falls outside of the last frame looked up.
+//For sorted times, that's once per distinct frame.
+struct FrameLocator {
+    int64_t framesFrom0;
+    int64_t frameStartUsec, frameEndUsec; //range of uS covered by frame #framesFrom0. Empty until the first call to locate.
+    FrameLocator() : framesFrom0(0), frameStartUsec(0), frameEndUsec(0) {}
+    //returns true if usecFromFrame0 lies in a different frame than the previously located time
+    bool locate(int64_t usecFromFrame0) {
+        if (frameStartUsec <= usecFromFrame0 && usecFromFrame0 < frameEndUsec) {
+            return false;
+        }
+        framesFrom0 = USEC_TO_FRAME(usecFromFrame0);
+        //first uS of this frame and of the next one (inverse of USEC_TO_FRAME, rounding up):
+        frameStartUsec = (framesFrom0*1000000 + (FRAMES_PER_SEC)-1) / (FRAMES_PER_SEC);
+        frameEndUsec = ((framesFrom0+1)*1000000 + (FRAMES_PER_SEC)-1) / (FRAMES_PER_SEC);
+        return true;
+    }
+    inline int index(int offset=0) const {
+        return (framesFrom0 + offset) % SOURCE_BUFFER_FRAMES;
+    }
+};
+
+std::size_t HardwareScheduler::queueBatch(const OutputEvent *evts, std::size_t num) {
+    //Accumulate the set/clear bits destined for one frame, and only write them to the frame once an event lands in a different frame.
+    uint64_t horizonMicros = std::chrono::duration_cast<std::chrono::microseconds>(EventClockT::now().time_since_epoch()).count() + MAX_SCHED_AHEAD_USEC;
+    int64_t lastUsecAtFrame0 = _lastTimeAtFrame0;
+    FrameLocator frame;
+    GpioFrameBits bits;
+    const OutputEvent *evt = evts;
+    for (; evt != evts + num; ++evt) {
+        uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(evt->time().time_since_epoch()).count();
+        if (micros > horizonMicros) {
+            break; //not writable yet
+        }
+        int64_t usecFromFrame0 = micros - lastUsecAtFrame0;
+        if (usecFromFrame0 < 0) {
+            //missed; let writeFrame handle the recovery.
+            writeFrame(evt->pinId(), evt->state(), micros);
+            continue;
+        }
+        int prevIdx = frame.index();
+        if (frame.locate(usecFromFrame0)) {
+            bits.flushInto(srcArray[prevIdx]);
+        }
+        int pin = evt->pinId();
+        int word = NUM_GPIO_WORDS == 1 ? 0 : (pin>31);
+        int shift = NUM_GPIO_WORDS == 1 ? pin : pin%32;
+        if (evt->state()) {
+            bits.gpset[word] |= 1<<shift;
+        } else {
+            bits.gpclr[word] |= 1<<shift;
+        }
+    }
+    bits.flushInto(srcArray[frame.index()]);
+    return evt - evts;
+}
+
+void HardwareScheduler::setStepDirOutputs(AxisIdType axis, const StepDirOutputs &outputs) {
+    if (axis >= MAX_STEP_RASTER_AXES) {
+        LOGE("HardwareScheduler::setStepDirOutputs: axis %i is beyond MAX_STEP_RASTER_AXES (%i)\n", (int)axis, MAX_STEP_RASTER_AXES);
+        return;
+    }
+    StepRasterAxis &a = _stepRasterAxes[axis];
+    a.dirWord = NUM_GPIO_WORDS == 1 ? 0 : (outputs.dirPin>31);
+    a.dirMask = 1 << (NUM_GPIO_WORDS == 1 ? outputs.dirPin : outputs.dirPin%32);
+    a.stepWord = NUM_GPIO_WORDS == 1 ? 0 : (outputs.stepPin>31);
+    a.stepMask = 1 << (NUM_GPIO_WORDS == 1 ? outputs.stepPin : outputs.stepPin%32);
+    //round the pulse up to whole frames, so that it's never shorter than requested.
+    a.pulseFrames = (outputs.pulseWidth.count()*(FRAMES_PER_SEC) + 999999) / 1000000;
+}
+
+std::size_t HardwareScheduler::queueSteps(const Event *steps, std::size_t num) {
+    //Each step clears its step pin & sets/clears its direction pin in the step's frame, and sets the step pin pulseFrames later.
+    //Bits for the step's frame and for the frame at the end of its pulse are accumulated separately, so that steps of several axes that share frames each cost one write per frame.
+    uint64_t nowMicros = std::chrono::duration_cast<std::chrono::microseconds>(EventClockT::now().time_since_epoch()).count();
+    uint64_t horizonMicros = nowMicros + MAX_SCHED_AHEAD_USEC;
+    int64_t lastUsecAtFrame0 = _lastTimeAtFrame0;
+    FrameLocator frame;
+    GpioFrameBits stepBits, pulseEndBits;
+    int pulseEndIdx = 0;
+    std::size_t i = 0;
+    for (; i != num; ++i) {
+        const Event &step = steps[i];
+        uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(step.time().time_since_epoch()).count();
+        if (micros > horizonMicros) {
+            break; //not writable yet
+        }
+        int64_t usecFromFrame0 = micros - lastUsecAtFrame0;
+        if (usecFromFrame0 < 0) {
+            LOGV("Warning: clearly missed a step (usecFromFrame0=%lli)\n", (long long)usecFromFrame0);
+            //attempt to recover (as in writeFrame):
+            usecFromFrame0 = nowMicros + MIN_SCHED_AHEAD_USEC - lastUsecAtFrame0;
+        }
+        int prevIdx = frame.index();
+        if (frame.locate(usecFromFrame0)) {
+            stepBits.flushInto(srcArray[prevIdx]);
+        }
+        assert(step.stepperId() < MAX_STEP_RASTER_AXES);
+        const StepRasterAxis &a = _stepRasterAxes[step.stepperId()];
+        if (step.direction() == StepForward) {
+            stepBits.gpset[a.dirWord] |= a.dirMask;
+        } else {
+            stepBits.gpclr[a.dirWord] |= a.dirMask;
+        }
+        stepBits.gpclr[a.stepWord] |= a.stepMask;
+        int endIdx = frame.index(a.pulseFrames);
+        if (endIdx != pulseEndIdx) {
+            pulseEndBits.flushInto(srcArray[pulseEndIdx]);
+            pulseEndIdx = endIdx;
+        }
+        pulseEndBits.gpset[a.stepWord] |= a.stepMask;
+    }
+    stepBits.flushInto(srcArray[frame.index()]);
+    pulseEndBits.flushInto(srcArray[pulseEndIdx]);
+    return i;
+}
+
 void HardwareScheduler::queuePwm(int pin, float ratio, float idealPeriod) {
     //PWM is achieved through changing the values that each source frame is reset to.
     //the way to choose which frames are '1' and which are '0' is like so:
@@ -141,6 +141,7 @@
 
  
 #include <stdint.h> //for uint32_t
+#include <array>
 #include <string.h> //for size_t, memset
 #include <chrono> //for std::chrono::microseconds
 #include <cassert>
@@ -148,6 +149,7 @@
 #include "drivers/auto/chronoclock.h" //for EventClockT
 #include "common/typesettings/enums.h" //for OnIdleCpuIntervalT
 #include "common/typesettings/compileflags.h" //for MAX_RPI_PIN_ID
+#include "stepdiroutputs.h"
 #include "outputevent.h" //We could do forward declaration, but queue(OutputEvent& evt) is called MANY times, so we want the performance boost potentially offered by defining the function in the header.
 
 //config settings:
@@ -157,6 +159,7 @@
 //#define SOURCE_BUFFER_FRAMES 32768
 #define SOURCE_BUFFER_FRAMES 65536
 #define SCHED_PRIORITY 30 //Linux scheduler priority. Higher = more realtime
+#define MAX_STEP_RASTER_AXES 8 //queueSteps can render the steps of stepperIds [0, MAX_STEP_RASTER_AXES)
 
 #define NOMINAL_CLOCK_FREQ 500000000 //PWM Clock runs at 500 MHz, unless overclocking
 #define BITS_PER_CLOCK 10 //# of bits to be used in each PWM cycle. Effectively acts as a clock divisor for us, since the PWM clock is in bits/second
@@ -518,6 +521,14 @@ class HardwareScheduler {
     DmaControlBlock *cbArr;
     int64_t _lastTimeAtFrame0;
     EventClockT::time_point _lastDmaSyncedTime;
+    //precomputed gpio masks for rendering each axis' steps (see setStepDirOutputs):
+    struct StepRasterAxis {
+        int dirWord, stepWord; //index into GpioBufferFrame::gpset/gpclr
+        uint32_t dirMask, stepMask;
+        int pulseFrames; //number of frames between pulling the step pin low & returning it high
+        StepRasterAxis() : dirWord(0), stepWord(0), dirMask(0), stepMask(0), pulseFrames(0) {}
+    };
+    std::array<StepRasterAxis, MAX_STEP_RASTER_AXES> _stepRasterAxes;
     public:
         HardwareScheduler();
         static void cleanup();
@@ -526,11 +537,29 @@ class HardwareScheduler {
             return true;
         }
         inline EventClockT::time_point schedTime(EventClockT::time_point evtTime) const {
-            return EventClockT::time_point(evtTime.time_since_epoch() - std::chrono::microseconds(SOURCE_BUFFER_FRAMES));
+            //an event can be written into the buffer once it's no more than MAX_SCHED_AHEAD_USEC in the future
+            return EventClockT::time_point(evtTime.time_since_epoch() - std::chrono::microseconds(MAX_SCHED_AHEAD_USEC));
+        }
+        inline EventClockT::time_point writableHorizon() const {
+            //events up to this time can currently be queued without waiting
+            return EventClockT::now() + std::chrono::microseconds(MAX_SCHED_AHEAD_USEC);
         }
         inline void queue(const OutputEvent &evt) {
             queue(evt.pinId(), evt.state(), std::chrono::duration_cast<std::chrono::microseconds>(evt.time().time_since_epoch()).count());
         }
+        static constexpr std::size_t maxRasterizedAxes() {
+            //steps of stepperIds [0, MAX_STEP_RASTER_AXES) can be rendered directly into the DMA buffer via queueSteps
+            return MAX_STEP_RASTER_AXES;
+        }
+        //precompute the gpio masks needed to render steps of the given axis (stepperId) in queueSteps
+        void setStepDirOutputs(AxisIdType axis, const StepDirOutputs &outputs);
+        //Render the step & direction outputs of each step straight into the DMA buffer, without creating any OutputEvents.
+        //Stops (without sleeping) at the first step beyond writableHorizon(), and returns the number of steps that were queued.
+        //Steps should be sorted by time, and each one's axis must have been configured with setStepDirOutputs.
+        std::size_t queueSteps(const Event *steps, std::size_t num);
+        //queue `num` events at once. Events that land in the same frame have their bits merged into a single write, which is cheapest if the events are sorted by time.
+        //Like queueSteps, this stops (without sleeping) at the first event beyond writableHorizon(), and returns the number of events that were queued.
+        std::size_t queueBatch(const OutputEvent *evts, std::size_t num);
         void queuePwm(int pin, float ratio, float maxPeriod);
         bool onIdleCpu(OnIdleCpuIntervalT interval);
     private:
@@ -544,6 +573,7 @@ class HardwareScheduler {
         void initDma();
         void syncDmaTime();
         void queue(int pin, int mode, uint64_t micros);
+        void writeFrame(int pin, int mode, uint64_t micros);
         /*inline uint64_t readSysTime() const {
             return ((uint64_t)*(timerBaseMem + TIMER_CHI/4) << 32) + (uint64_t)(*(timerBaseMem + TIMER_CLO/4));
         }*/
@@ -1,7 +1,7 @@
 #include "event.h"
 
-Event Event::StepperEvent(float relTime, AxisIdType stepperNum, StepDirection dir) {
-    auto t = std::chrono::duration_cast<EventClockT::duration>(std::chrono::duration<float>(relTime));
+Event Event::StepperEvent(StepTimeT relTime, AxisIdType stepperNum, StepDirection dir) {
+    auto t = std::chrono::duration_cast<EventClockT::duration>(relTime); //integer conversion
     return Event(EventClockT::time_point(t), stepperNum, dir);
 }
 
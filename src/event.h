@@ -60,7 +60,7 @@ class Event {
         }
         Event() : _time(), _stepperNum(NULL_STEPPER_ID) {}
         Event(EventClockT::time_point t, AxisIdType stepperNum, StepDirection dir) : _time(t), _stepperNum(stepperNum), _isForward(dir==StepForward) {}
-        static Event StepperEvent(float relTime, AxisIdType stepperNum, StepDirection dir);
+        static Event StepperEvent(StepTimeT relTime, AxisIdType stepperNum, StepDirection dir);
         
         template <typename DurationT> void offset(const DurationT offset) {
             this->_time += std::chrono::duration_cast<EventClockT::duration>(offset);
@@ -139,6 +139,15 @@ class Command {
         inline float getS(bool &hasParam) const {
             return getFloatParam('S', hasParam);
         }
+        inline float getI(bool &hasParam) const { //arc center X offset (G2/G3)
+            return getFloatParam('I', hasParam);
+        }
+        inline float getJ(bool &hasParam) const { //arc center Y offset (G2/G3)
+            return getFloatParam('J', hasParam);
+        }
+        inline float getR(bool &hasParam) const { //arc radius (G2/G3)
+            return getFloatParam('R', hasParam);
+        }
         inline bool hasX() const {
             return hasParam('X');
         }
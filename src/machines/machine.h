@@ -1,10 +1,16 @@
 #ifndef DRIVERS_MACHINES_MACHINE_H
 #define DRIVERS_MACHINES_MACHINE_H
 
+#include <cmath> //for INFINITY
+#include <cstddef> //for size_t
+#include "motion/inputshaper.h" //for NoInputShaper
+
 namespace machines {
 
 class Machine {
     public:
+        //The MotionPlanner shapes the commanded path with this, to reduce ringing in the frame (see motion/inputshaper.h). No shaping by default.
+        typedef NoInputShaper InputShaperT;
         inline float defaultMoveRate() const { //in mm/sec
             return 0;
         }
@@ -15,12 +21,32 @@ class Machine {
         inline float maxExtrudeRate() const { //in mm/sec
             return 0;
         }
+        //per-axis limits, indexed like the mechanical axes of the CoordMap (eg each tower's carriage of a delta, then the extruder).
+        //The MotionPlanner slows each move just enough that no axis exceeds them.
+        inline float maxAxisVel(std::size_t /*axis*/) const { //in mm/sec
+            return INFINITY;
+        }
+        inline float maxAxisAccel(std::size_t /*axis*/) const { //in mm/sec^2
+            return INFINITY;
+        }
         inline float clampMoveRate(float inp) const {
             return inp; 
         }
         inline float clampHomeRate(float inp) const {
             return inp;
         }
+        inline float homeApproachRate() const { //in mm/sec. If faster than the home rate, homing first approaches the endstops at this rate, then backs off by homeBackOffDist() & approaches them again at the home rate.
+            return 0;
+        }
+        inline float homeBackOffDist() const { //in mm
+            return 5;
+        }
+        inline float junctionDeviation() const { //in mm. How far the path may deviate from the corner between two moves in order to take it without stopping. 0 = always stop at corners.
+            return 0;
+        }
+        inline float pressureAdvance() const { //in sec. How far ahead of its nominal position to drive the extruder, per mm/sec of extrusion rate. 0 = disabled.
+            return 0;
+        }
         inline bool doHomeBeforeFirstMovement() const {
             return true; //if we get a G1 before the first G28, then yes - we want to home first.
         }
@@ -6,6 +6,7 @@
 #include "common/filters/lowpassfilter.h"
 //#include "motion/exponentialacceleration.h"
 #include "motion/constantacceleration.h"
+//#include "motion/scurveacceleration.h"
 #include "machines/machine.h"
 #include "drivers/axisstepper.h"
 #include "drivers/linearstepper.h"
@@ -38,6 +39,8 @@
 //#define MAX_ACCEL1000 1200000
 //#define MAX_ACCEL1000 450000
 #define MAX_ACCEL1000 900000
+#define MAX_JERK1000 90000000 //only used by SCurveAcceleration
+#define RING_FREQ1000 40000 //resonant frequency of the frame (mHz). Only used by the InputShaperT
 //Can reach 160mm/sec at full-stepping (haven't tested the limits)
 //75mm/sec uses 75% cpu at quarter-stepping (unoptimized)
 //90mm/sec uses 75% cpu at quarter-stepping (optimized - Aug 10)
@@ -51,7 +54,15 @@
 //#define MAX_MOVE_RATE 60
 //#define MAX_MOVE_RATE 50
 #define HOME_RATE 10
+#define HOME_APPROACH_RATE 60 //the endstops are first found at this rate, then approached again at HOME_RATE
+#define HOME_BACKOFF 5 //mm
+#define JUNCTION_DEVIATION 0.05
+#define PRESSURE_ADVANCE 0 //sec. Depends upon the filament & hotend, so leave disabled until it's been tuned (try 0.02-0.1 for a bowden extruder)
 #define MAX_EXT_RATE 150
+//Near the edge of the build plate, the carriages move (and accelerate) up to several times faster than the effector:
+#define MAX_CARRIAGE_RATE 250
+#define MAX_CARRIAGE_ACCEL1000 2000000
+#define MAX_EXT_ACCEL1000 10000000
 //#define MAX_EXT_RATE 24
 //#define MAX_EXT_RATE 60
 
@@ -138,8 +149,13 @@ class KosselPi : public Machine {
         typedef matr::Matrix3Static<999975003, 5356, -7070522, 
 5356, 999998852, 1515111, 
 7070522, -1515111, 999973855, 1000000000> _BedLevelT; //[-0.007, 0.0015, 0.99]
+        //An uneven bed can additionally be corrected by a mesh of probed heights (generated by util/bedmesh.py), passed as the CoordMap's last template argument:
+        //typedef BedMesh<-80000, -80000, 40000, 5, 5, ...> _BedMeshT;
     public:
         typedef ConstantAcceleration<MAX_ACCEL1000> AccelerationProfileT;
+        //typedef SCurveAcceleration<MAX_ACCEL1000, MAX_JERK1000> AccelerationProfileT;
+        //Ringing can be reduced by shaping the commanded path (at the cost of slightly rounded corners), which permits a higher MAX_ACCEL1000:
+        //typedef ZvdShaper<RING_FREQ1000> InputShaperT;
 
         typedef LinearDeltaCoordMap<R1000, L1000, H1000, BUILDRAD1000, STEPS_M, STEPS_M_EXT, _BedLevelT> CoordMapT;
         typedef std::tuple<LinearDeltaStepper<0, CoordMapT, R1000, L1000, STEPS_M, _EndstopA>, LinearDeltaStepper<1, CoordMapT, R1000, L1000, STEPS_M, _EndstopB>, LinearDeltaStepper<2, CoordMapT, R1000, L1000, STEPS_M, _EndstopC>, LinearStepper<STEPS_M_EXT, COORD_E> > AxisStepperTypes;
@@ -161,6 +177,12 @@ class KosselPi : public Machine {
         inline float maxExtrudeRate() const { //in mm/sec
             return MAX_EXT_RATE;
         }
+        inline float maxAxisVel(std::size_t axis) const { //in mm/sec. Axes 0-2 are the carriages, and 3 is the extruder
+            return axis == 3 ? MAX_EXT_RATE : MAX_CARRIAGE_RATE;
+        }
+        inline float maxAxisAccel(std::size_t axis) const { //in mm/sec^2
+            return axis == 3 ? MAX_EXT_ACCEL1000/1000. : MAX_CARRIAGE_ACCEL1000/1000.;
+        }
         inline float clampMoveRate(float inp) const {
             return std::min(inp, defaultMoveRate());//ensure we never move too fast.
         }
@@ -168,6 +190,18 @@ class KosselPi : public Machine {
             (void)inp; //unused argument
             return HOME_RATE;
         }
+        inline float homeApproachRate() const {
+            return HOME_APPROACH_RATE;
+        }
+        inline float homeBackOffDist() const {
+            return HOME_BACKOFF;
+        }
+        inline float junctionDeviation() const { //in mm
+            return JUNCTION_DEVIATION;
+        }
+        inline float pressureAdvance() const { //in sec
+            return PRESSURE_ADVANCE;
+        }
         inline bool doHomeBeforeFirstMovement() const {
             return true; //if we get a G1 before the first G28, then yes - we want to home first!
         }
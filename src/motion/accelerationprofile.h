@@ -29,8 +29,11 @@
  * 0.1, 0.2, 0.3, 0.4, 0.5, 0.6
  * and transform them to something like:
  * 0.2, 0.35, 0.5, 0.6, 0.75, 0.9
- * Currently, the initial and final velocity should both be 0 mm/sec.
- * Note that the events are already encoded at a *constant* velocity of Vmax (mm/sec) when they are passed through the AccelerationProfile. The AccelerationProfile should re-encode them so that the accelerate up to Vmax and then back to 0, and the velocity NEVER EXCEEDS Vmax.
+ * Note that the events are already encoded at a *constant* velocity of Vmax (mm/sec) when they are passed through the AccelerationProfile. The AccelerationProfile should re-encode them so that they accelerate from Vstart up to Vmax and then back down to Vend, and the velocity NEVER EXCEEDS Vmax.
+ * Vstart and Vend are chosen by the MotionPlanner so that consecutive moves can be blended without stopping at each joint. They will never be larger than maxAccel() allows over the length of the move.
+ * A profile which cannot start or end a move while in motion should report a maxAccel() of 0, in which case Vstart and Vend will always be 0 mm/sec.
+ * The MotionPlanner may further limit the acceleration of individual moves (accelLimit), eg if they load an axis that can't accelerate as quickly as the others.
+ * Times passed to & returned from transform() are integer StepTimeTs (nanoseconds since the start of the move), so the profile should use doubles internally wherever a float would lose resolution late in a long move.
  *
  * Note: AccelerationProfile is an interface and all derivatives must implement the methods outlined in the AccelerationProfile class. NoAcceleration can be considered a default implementation of this interface.
  */
@@ -39,13 +42,21 @@
 #define MOTION_ACCELERATIONPROFILE_H
 
 
+#include <cmath> //for INFINITY
+#include "common/typesettings/primitives.h" //for StepTimeT
+
 struct AccelerationProfile {
-    inline void begin(float /*moveDuration*/, float /*Vmax*/) {} //Optional, but almost surely needed.
-    //float transform(float inp, float moveDuration, float Vmax);
+    inline void begin(float /*moveDuration*/, float /*Vmax*/, float /*Vstart*/=0, float /*Vend*/=0, float /*accelLimit*/=INFINITY) {} //Optional, but almost surely needed.
+    //StepTimeT transform(StepTimeT inp);
+    inline float maxAccel() const { return 0; } //mm/sec^2. Used by the MotionPlanner to plan the velocities at which to enter/exit each move.
+    //the largest velocity that can be reached by accelerating from vel over dist mm (or that can decelerate to vel over dist mm), with the acceleration also limited to accelLimit
+    inline float maxReachableVel(float vel, float /*dist*/, float /*accelLimit*/=INFINITY) const { return vel; }
 };
 
 struct NoAcceleration : public AccelerationProfile {
-    float transform(float inp) { return inp; }
+    StepTimeT transform(StepTimeT inp) { return inp; }
+    inline float maxAccel() const { return INFINITY; } //velocity changes are instantaneous, so every joint may be taken at full speed.
+    inline float maxReachableVel(float /*vel*/, float /*dist*/, float /*accelLimit*/=INFINITY) const { return INFINITY; }
 };
 
 
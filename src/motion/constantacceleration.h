@@ -25,7 +25,8 @@
  * Printipi/motion/constantacceleration.h
  *
  * ConstantAcceleration is an implementation of motion/AccelerationProfile in which 
- *  v(t) = {at [if at < vmax], vmax [if t < duration-accelTime], vmax - a(t-t1) [if t > duration-accelTime] }
+ *  v(t) = {v0 + at [if v0 + at < vmax], vmax [if t < duration-decelTime], vmax - a(t-t2) [if t > duration-decelTime] }
+ * where v0 is the velocity at which the move is entered (likewise, the deceleration ends at the move's exit velocity rather than 0).
  *
  * Polynomial acceleration profiles turn out to be non-trivial, so only constant, linear, and quadratic acceleration have a closed-form solution (above that requires solving the roots of an n+1 degree polynomial. Event just linear acceleration requires solving a degree 3 polynomial.
  */
@@ -35,41 +36,72 @@
 
 #include "accelerationprofile.h"
 #include "common/logging.h"
+#include <cmath> //for sqrt, isnan
+#include <algorithm> //for min, max
 
 template <int Accel1000> class ConstantAcceleration : public AccelerationProfile {
     static constexpr float a() { return Accel1000 / 1000.; }
-    float moveDuration;
-    float tmax1, tmax2;
-    float tbase3;
-    float twiceVmax_a;
+    //For a move of nominal (constant-velocity) duration D at Vmax that begins at v0 and ends at v1, the peak velocity is
+    //  vp = min(Vmax, sqrt(a*Vmax*D + (v0^2 + v1^2)/2)).
+    //Writing s = Vmax*t for the distance travelled by a constant-velocity event at time t, the real time T of that event is:
+    //  accelerating (t < tmax1): s = v0*T + a/2*T^2  => T = sqrt(accelRoot + twiceVmax_a*t) - v0_a
+    //  constant velocity (t < tmax2): T = t*Vmax/vp + tbase2
+    //  decelerating: T = tbase3 - sqrt(decelRoot - twiceVmax_a*t)
+    //With v0 = v1 = 0, these reduce to the usual sqrt(2*Vmax/a*t), t + Vmax/2/a and D + Vmax/a - sqrt(2*Vmax/a*(D-t)).
+    //All times are in seconds. Doubles are used so that step times late in a long move are resolved to well under a microsecond.
+    double tmax1, tmax2;
+    double v0_a, accelRoot;
+    double cruiseRatio, tbase2;
+    double tbase3, decelRoot;
+    double twiceVmax_a;
     public:
-        void begin(float moveDuration, float Vmax) {
-            this->moveDuration = moveDuration;
-            this->tmax1 = Vmax/2/a();
-            this->tmax2 = std::isnan(moveDuration) ? INFINITY : moveDuration - Vmax/2/a();
-            this->tmax1 = std::min(tmax1, tmax2); //for really short movements, we may not be able to fully accelerate.
-            this->tbase3 = moveDuration + Vmax/a(); //TODO: is this the true tbase3 for short movements?
-            this->twiceVmax_a = 2*Vmax/a();
-            LOGD("Accel::begin dur, Vmax: %f, %f\n", moveDuration, Vmax);
-            LOGD("Accel::begin tmax1, tmax2, tbase3, twiceVmax_a: %f, %f, %f, %f\n", tmax1, tmax2, tbase3, twiceVmax_a);
+        ConstantAcceleration() : tmax1(0), tmax2(INFINITY), v0_a(0), accelRoot(0), cruiseRatio(1), tbase2(0), tbase3(0), decelRoot(0), twiceVmax_a(0) {}
+        inline float maxAccel() const {
+            return a();
         }
-        //float transform(float time, float moveDuration, float Vmax) {
-        float transform(float time) {
-            /*if (time < Vmax/2/a()) { //accelerating
-                return std::sqrt(2*Vmax/a()*time);
-            } else if (time < moveDuration - Vmax/2/a() || std::isnan(moveDuration)) { //constant velocity
-                return time + Vmax/2/a();
-            } else { //decelerating. Should never be reached if moveDuration is NAN (ie in homing routine)
-                return moveDuration + Vmax/a() - std::sqrt(2*Vmax/a()*(moveDuration-time));
-            }*/
+        inline float maxReachableVel(float vel, float dist, float accelLimit=INFINITY) const {
+            return dist > 0 ? std::sqrt(vel*vel + 2*std::min(a(), accelLimit)*dist) : vel;
+        }
+        void begin(float moveDuration, float Vmax, float Vstart=0, float Vend=0, float accelLimit=INFINITY) {
+            if (!(Vmax > 0)) { //no cartesian movement (eg extrusion-only), so there's nothing to accelerate.
+                this->tmax1 = 0;
+                this->tmax2 = INFINITY;
+                this->cruiseRatio = 1;
+                this->tbase2 = 0;
+                return;
+            }
+            double accel = std::min(a(), accelLimit);
+            double dist = (double)Vmax*moveDuration; //NaN if moveDuration is NaN (ie in homing routine)
+            double vp = std::isnan(moveDuration) ? Vmax : std::min((double)Vmax, std::sqrt(accel*dist + 0.5*(Vstart*Vstart + Vend*Vend)));
+            vp = std::max(vp, (double)std::max(Vstart, Vend)); //guard against rounding errors in the planner's entry/exit velocities.
+            double s1 = (vp*vp - Vstart*Vstart)/(2*accel); //distance at which acceleration ends
+            double s2 = std::isnan(moveDuration) ? INFINITY : std::max(s1, dist - (vp*vp - Vend*Vend)/(2*accel)); //distance at which deceleration begins
+            this->twiceVmax_a = 2*Vmax/accel;
+            this->tmax1 = s1/Vmax;
+            this->tmax2 = s2/Vmax;
+            this->v0_a = Vstart/accel;
+            this->accelRoot = v0_a*v0_a;
+            this->cruiseRatio = Vmax/vp;
+            double T1 = (vp - Vstart)/accel; //real time at which acceleration ends
+            this->tbase2 = T1 - tmax1*cruiseRatio;
+            double T2 = T1 + (s2 - s1)/vp; //real time at which deceleration begins
+            this->tbase3 = T2 + vp/accel;
+            this->decelRoot = (vp/accel)*(vp/accel) + 2*s2/accel;
+            LOGD("Accel::begin dur, Vmax, Vstart, Vend: %f, %f, %f, %f\n", moveDuration, Vmax, Vstart, Vend);
+            LOGD("Accel::begin tmax1, tmax2, tbase2, tbase3, vp: %f, %f, %f, %f, %f\n", tmax1, tmax2, tbase2, tbase3, vp);
+        }
+        StepTimeT transform(StepTimeT stepTime) {
+            double time = stepTime.count()*1e-9; //seconds
             LOGV("Accel::transform: %f\n", time);
+            double real;
             if (time < tmax1) { //accelerating
-                return std::sqrt(twiceVmax_a*time);
+                real = std::sqrt(accelRoot + twiceVmax_a*time) - v0_a;
             } else if (time < tmax2) { //constant velocity
-                return time + tmax1; //convenient reuse of semi-constant.
+                real = time*cruiseRatio + tbase2;
             } else { //decelerating. Should never be reached if moveDuration was NAN (ie in homing routine)
-                return tbase3 - std::sqrt(twiceVmax_a*(moveDuration-time));
+                real = tbase3 - std::sqrt(std::max(0., decelRoot - twiceVmax_a*time)); //max guards against rounding error at the very end of a move that ends at rest
             }
+            return StepTimeT((StepTimeT::rep)(real*1e9 + 0.5));
         }
 };
 
@@ -27,45 +27,123 @@
  * ExponentialAcceleration is an implementation of motion/AccelerationProfile in which 
  * v(t) = f(e^t)
  * This has the possibility to have no instantaneous acceleration, or even impulse.
- * Unfortunately, the current version has v(0) != 0 (so there is instantaneous velocity), and is computationally expensive.
- * For those reasons, I recommend against using this acceleration implementation until it is improved.
+ * Unfortunately, the current version has v(0) != 0 (so there is instantaneous velocity).
+ * For that reason, I recommend against using this acceleration implementation until it is improved.
+ *
+ * The transform itself involves an exp and a log, which are too expensive to evaluate for every step.
+ * Instead, begin() tabulates it (and its derivative) for the move, and transform() does a cubic Hermite interpolation of the table.
+ * The transform is symmetric about the middle of the move, so only the first half needs to be tabulated.
+ * Near t=0, the transform changes on a time scale of about V0/Amax (tens of microseconds), whereas later it changes on a scale of Vmax/Amax.
+ *   So the table is spaced geometrically: each octave of time ([2^n, 2^(n+1)) seconds) gets the same number of entries,
+ *   and an entry is found from the binary exponent & mantissa of t without evaluating any log.
  */
  
 #ifndef MOTION_EXPONENTIALACCELERATION_H
 #define MOTION_EXPONENTIALACCELERATION_H
 
 #include "accelerationprofile.h"
-#include <algorithm> //min, isfinite
+#include "common/logging.h"
+#include <array>
+#include <algorithm> //for min, max
+#include <cmath> //for exp, log, frexp, ldexp, isnan
+
+//the table spans at most this many octaves of time, ending at the middle of the move.
+#ifndef EXPONENTIALACCELERATION_TABLE_OCTAVES
+    #define EXPONENTIALACCELERATION_TABLE_OCTAVES 32
+#endif
+//number of (evenly-spaced) table intervals per octave. The interpolation error falls with the 4th power of this.
+#ifndef EXPONENTIALACCELERATION_TABLE_STEPS_PER_OCTAVE
+    #define EXPONENTIALACCELERATION_TABLE_STEPS_PER_OCTAVE 8
+#endif
 
 template <int MaxAccel1000> class ExponentialAcceleration : public AccelerationProfile {
-    static constexpr float maxAccel() { return MaxAccel1000 / 1000.; }
-    float moveDuration;
-    float Vmax;
+    static constexpr float a() { return MaxAccel1000 / 1000.; } //Note: maxAccel() is left at the AccelerationProfile default of 0, as this profile can only start and end at rest.
+    static constexpr int M = EXPONENTIALACCELERATION_TABLE_STEPS_PER_OCTAVE;
+    static constexpr int MAX_INTERVALS = EXPONENTIALACCELERATION_TABLE_OCTAVES*M;
+    double moveDuration; //NaN if the move is of indefinite length (ie homing)
+    double tableMid; //the middle of the move (or the end of the table if the move is indefinite)
+    int minExp, maxExp; //the table covers constant-velocity times [2^minExp, 2^maxExp) seconds
+    double tableLo, tableHi; //2^minExp, 2^maxExp
+    double k, c; //parameters of the exact transform
+    double slope0; //derivative of the transform at t=0, used below the start of the table
+    double twiceMid; //2*transform(tableMid); the second half of the move is mirrored about this
+    //Interval o*M + j spans times (1 + [j, j+1]/M)*2^(minExp+o). Within it, the transform is approximated by the cubic (Hermite) polynomial
+    //  poly[0] + u*poly[1] + u^2*poly[2] + u^3*poly[3], where u is the fractional position in the interval.
+    std::array<std::array<double, 4>, MAX_INTERVALS> poly;
+    bool isIdentity; //true if there's no (cartesian) movement to accelerate
     public:
-        void begin(float moveDuration, float Vmax) {
+        ExponentialAcceleration() : moveDuration(0), tableMid(0), minExp(0), maxExp(0), tableLo(0), tableHi(0), k(0), c(0), slope0(0), twiceMid(0), poly(), isIdentity(true) {}
+        void begin(float moveDuration, float Vmax, float /*Vstart*/=0, float /*Vend*/=0, float accelLimit=INFINITY) {
             this->moveDuration = moveDuration;
-            this->Vmax = Vmax;
+            isIdentity = !(Vmax > 0);
+            if (isIdentity) {
+                return;
+            }
+            double Amax = std::min(a(), accelLimit);
+            double V0 = std::min(0.5*Vmax, 0.1); //c becomes invalid if V0 >= Vmax
+            k = 4*Amax/Vmax;
+            c = V0 / (Vmax-V0);
+            slope0 = (1.+c)/c;
+            //For an indefinite move, tabulate up to the point at which the transform is indistinguishable from its asymptote (ie e^(-kt) is negligible).
+            tableMid = std::isnan(moveDuration) ? 25./k : 0.5*moveDuration;
+            std::frexp(tableMid, &maxExp); //tableMid < 2^maxExp
+            //The transform is linear to within a negligible error for t << c/k, so the table needn't start much below that.
+            int cExp;
+            std::frexp(c/k, &cExp);
+            minExp = std::max(maxExp - EXPONENTIALACCELERATION_TABLE_OCTAVES, std::min(maxExp-1, cExp - 10));
+            tableLo = std::ldexp(1., minExp);
+            tableHi = std::ldexp(1., maxExp);
+            int numIntervals = (maxExp - minExp)*M;
+            double t0 = tableLo, T0 = _exact(t0), dT0 = _derivative(t0);
+            for (int i=0; i<numIntervals; ++i) {
+                double h = std::ldexp(1./M, minExp + i/M); //width of the interval
+                double t1 = t0 + h, T1 = _exact(t1), dT1 = _derivative(t1);
+                //Hermite basis, expanded into powers of u:
+                poly[i][0] = T0;
+                poly[i][1] = h*dT0;
+                poly[i][2] = 3*(T1 - T0) - h*(2*dT0 + dT1);
+                poly[i][3] = 2*(T0 - T1) + h*(dT0 + dT1);
+                t0 = t1; T0 = T1; dT0 = dT1;
+            }
+            twiceMid = 2*_lookup(tableMid);
+            LOGD("ExponentialAccel::begin dur, Vmax, k, c: %f, %f, %f, %f (%i table intervals)\n", moveDuration, Vmax, k, c, numIntervals);
+        }
+        StepTimeT transform(StepTimeT time) {
+            if (isIdentity) {
+                return time;
+            }
+            double t = time.count()*1e-9; //seconds
+            double real;
+            if (t > tableMid && !std::isnan(moveDuration)) {
+                //second half of the move, which is the first half mirrored.
+                real = twiceMid - _lookup(moveDuration - t);
+            } else {
+                real = _lookup(t);
+            }
+            return StepTimeT((StepTimeT::rep)(real*1e9 + 0.5));
+        }
+    private:
+        //exact transform: 1/k * log(1/c * ((1+c)*e^(kt) - 1)), rearranged so that it neither overflows for large kt nor loses precision for small kt
+        double _exact(double t) const {
+            return t + std::log1p(-std::expm1(-k*t)/c)/k;
+        }
+        double _derivative(double t) const {
+            return (1.+c)/(c - std::expm1(-k*t));
         }
-        float transform(float time) {
-            //float Amax = this->driver.maxAccel();
-            float Amax = maxAccel();
-            float V0 = std::min(0.5*Vmax, 0.1); //c becomes invalid if V0 >= Vmax
-            float k = 4*Amax/Vmax;
-            float c = V0 / (Vmax-V0);
-            if (time > 0.5*moveDuration) {
-                return 2*transform(0.5*moveDuration, moveDuration, Vmax) - transform(moveDuration-time, moveDuration, Vmax);
-            } else { //take advantage of the fact that comparisons against NaN always compare false to allow for indefinite movements:
-                //the problem with the below equation is that it can return infinity if k/Vmax*time is sufficiently large.
-                //return 1./k * log(1./c * ((1. + c)*exp(k/Vmax*time) - 1.));
-                //aka: 1./k*( log(1./c) + log((1. + c)*exp(k/Vmax*time) - 1.))
-                //simplify: 1./k*log(e^x-1) ~=~ 1./k*x at x = Log[1 - E^(-k*.001)], at which point it is only .001 off (however, 1ms is significant! Would rather use a smaller value.
-                auto logparam = (1. + c)*exp(k*time) - 1;
-                if (std::isfinite(logparam)) {
-                    return 1./k*( log(1./c) + log(logparam));
-                } else { //use the approximation:
-                    return 1./k*(log(1./c) + log(1. + c) + k*time);
-                }
+        double _lookup(double t) const {
+            if (t < tableLo) { //the transform is linear near 0
+                return std::max(0., t)*slope0;
+            } else if (t >= tableHi) { //beyond the table (only possible for moves of indefinite length). The asymptote is exact here (to double precision).
+                return t + std::log1p(1./c)/k;
             }
+            //t = mantissa * 2^exp, with mantissa in [0.5, 1), so t lies in octave exp-1.
+            int exp;
+            double mantissa = std::frexp(t, &exp);
+            double x = (2*mantissa - 1)*M;
+            int j = (int)x;
+            const std::array<double, 4> &p = poly[(exp-1 - minExp)*M + j];
+            double u = x - j;
+            return p[0] + u*(p[1] + u*(p[2] + u*p[3]));
         }
 };
 
@@ -0,0 +1,234 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Colin Wallace
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Printipi/motion/inputshaper.h
+ *
+ * InputShaper reduces the ringing that the commanded motion excites in the frame. It's a stage of the MotionPlanner (see its Shaper parameter),
+ *   between the planned segments and the AxisSteppers: the commanded cartesian position is convolved with a few impulses,
+ *   spaced half a (damped) period of the frame's resonance apart, whose responses cancel:
+ *   p'(t) = sum(A_i * p(t - i*halfPeriod))
+ * The shaped velocity is then a weighted average of delayed copies of the commanded one, so it never exceeds the commanded velocity or acceleration.
+ * The shapers are ZvShaper, ZvdShaper and EiShaper, which tolerate increasing error in the resonant frequency (at the cost of more smoothing).
+ *
+ * The shaping is applied to the path as a whole, not to each move, so the change of direction at a corner is shaped as well as the acceleration along a move.
+ *   The motion only lags the commanded path by the duration of the shaper (one period for ZVD & EI, half for ZV), which is added once each time the machine comes to rest.
+ *   In exchange, corners are rounded by roughly the distance travelled over that duration.
+ *
+ * The commanded position is sampled at nodes INPUT_SHAPER_NODES_PER_HALF_PERIOD per half period apart. Since the impulses lie on nodes,
+ *   only the last few samples are needed to shape the next node, and they're kept in a fixed-size ring. The MotionPlanner steps straight chords
+ *   between the shaped nodes; their error is ~accel*(halfPeriod/n)^2/8.
+ * AccelerationProfileInverse finds where along a move the commanded position is at each node, as the AccelerationProfiles only map the other way.
+ */
+
+#ifndef MOTION_INPUTSHAPER_H
+#define MOTION_INPUTSHAPER_H
+
+#include "common/typesettings/primitives.h" //for StepTimeT
+#include <array>
+#include <cmath> //for exp, sqrt, fabs
+#include <cstddef> //for size_t
+
+//number of nodes at which the position is sampled per half period of the resonance. The chord error is ~accel*(halfPeriod/n)^2/8
+#ifndef INPUT_SHAPER_NODES_PER_HALF_PERIOD
+    #define INPUT_SHAPER_NODES_PER_HALF_PERIOD 8
+#endif
+
+//Impulse i of a shaper is delayed by i half periods of the resonance, which is at Freq1000/1000 Hz with a damping ratio of Damping1000/1000.
+template <int Freq1000, int Damping1000> struct InputShaperFilter {
+    //the ratio by which the ringing decays over each half period:
+    static double K() {
+        double zeta = Damping1000 / 1000.;
+        return std::exp(-zeta*3.14159265358979323846/std::sqrt(1 - zeta*zeta));
+    }
+    //half of the damped period of the resonance, in seconds:
+    static double halfPeriod() {
+        double zeta = Damping1000 / 1000.;
+        return 0.5 / (Freq1000/1000. * std::sqrt(1 - zeta*zeta));
+    }
+};
+
+//Zero Vibration: the shortest shaper, but it only cancels ringing very close to the given frequency.
+template <int Freq1000, int Damping1000=100> struct ZvShaper : public InputShaperFilter<Freq1000, Damping1000> {
+    static constexpr std::size_t numImpulses() { return 2; }
+    static std::array<double, 2> amplitudes() {
+        double K = ZvShaper::K();
+        return {{ 1/(1+K), K/(1+K) }};
+    }
+};
+
+//Zero Vibration and Derivative: also cancels ringing at nearby frequencies.
+template <int Freq1000, int Damping1000=100> struct ZvdShaper : public InputShaperFilter<Freq1000, Damping1000> {
+    static constexpr std::size_t numImpulses() { return 3; }
+    static std::array<double, 3> amplitudes() {
+        double K = ZvdShaper::K();
+        double sum = (1+K)*(1+K);
+        return {{ 1/sum, 2*K/sum, K*K/sum }};
+    }
+};
+
+//Extra Insensitive: allows 5% of the ringing at the given frequency, in exchange for reducing it over a much wider band than ZVD.
+template <int Freq1000, int Damping1000=100> struct EiShaper : public InputShaperFilter<Freq1000, Damping1000> {
+    static constexpr std::size_t numImpulses() { return 3; }
+    static std::array<double, 3> amplitudes() {
+        double K = EiShaper::K();
+        double vTol = 0.05;
+        double a0 = 0.25*(1 + vTol), a1 = 0.5*(1 - vTol)*K, a2 = a0*K*K;
+        double sum = a0 + a1 + a2;
+        return {{ a0/sum, a1/sum, a2/sum }};
+    }
+};
+
+//No shaping (the MotionPlanner's default): the commanded path is stepped directly.
+struct NoInputShaper {
+    static constexpr std::size_t numImpulses() { return 1; }
+    static std::array<double, 1> amplitudes() {
+        return {{ 1 }};
+    }
+    static double halfPeriod() {
+        return 0;
+    }
+};
+
+//Shapes the commanded position, one node at a time, with one of the shapers above.
+template <typename Shaper> class InputShaper {
+    public:
+        typedef std::array<float, 4> Position; //(x, y, z, e)
+    private:
+        static constexpr int M = INPUT_SHAPER_NODES_PER_HALF_PERIOD;
+        static constexpr std::size_t N = Shaper::numImpulses();
+        static constexpr int DELAY_NODES = (N-1)*M; //nodes spanned by the shaper
+        static constexpr int RING_LEN = DELAY_NODES + 1;
+        std::array<double, N> _amplitudes;
+        std::array<Position, RING_LEN> _ring; //unshaped position at the last RING_LEN nodes
+        int _head; //index in _ring of the last node
+        int _nodesSinceChange; //number of nodes since the unshaped position last changed (up to DELAY_NODES)
+    public:
+        InputShaper() : _amplitudes(Shaper::amplitudes()), _ring(), _head(0), _nodesSinceChange(DELAY_NODES) {}
+        static constexpr bool isEnabled() {
+            return N > 1;
+        }
+        //real time between nodes:
+        static StepTimeT nodeSpacing() {
+            return StepTimeT((StepTimeT::rep)(Shaper::halfPeriod()/M*1e9 + 0.5));
+        }
+        //restart the shaping, with the machine at rest at pos
+        void reset(const Position &pos) {
+            _ring.fill(pos);
+            _head = 0;
+            _nodesSinceChange = DELAY_NODES;
+        }
+        //true once the shaped position has caught up with the unshaped one, ie it's held still for the duration of the shaper
+        bool isSettled() const {
+            return _nodesSinceChange >= DELAY_NODES;
+        }
+        //add the unshaped position at the next node, and return the shaped position there
+        Position push(const Position &pos) {
+            if (pos != _ring[_head]) {
+                _nodesSinceChange = 0;
+            } else if (_nodesSinceChange < DELAY_NODES) {
+                ++_nodesSinceChange;
+            }
+            _head = (_head + 1) % RING_LEN;
+            _ring[_head] = pos;
+            if (isSettled()) {
+                return pos; //exactly, rather than to within the rounding of the sum below
+            }
+            Position shaped;
+            for (std::size_t c=0; c<shaped.size(); ++c) {
+                double p = 0;
+                for (std::size_t i=0; i<N; ++i) {
+                    p += _amplitudes[i]*_ring[(_head + RING_LEN - i*M) % RING_LEN][c];
+                }
+                shaped[c] = p;
+            }
+            return shaped;
+        }
+};
+
+//Finds the constant-velocity time at which an AccelerationProfile reaches each of an increasing sequence of real times within a move, ie the inverse of its transform().
+template <typename AccelProfile> class AccelerationProfileInverse {
+    double _duration; //constant-velocity duration of the move
+    double _realDuration; //real duration of the move, according to the profile
+    double _tauHint, _realHint; //the last point found
+    double _tauRate; //the rate of constant-velocity time per real time there (used to guess the next)
+    public:
+        AccelerationProfileInverse() : _duration(0), _realDuration(0), _tauHint(0), _realHint(0), _tauRate(0) {}
+        //the profile must have begun the move. vStart is the entry velocity relative to Vmax.
+        void begin(AccelProfile &profile, double duration, double vStart) {
+            _duration = duration;
+            _realDuration = profile.transform(_time(duration)).count()*1e-9;
+            _tauHint = 0;
+            _realHint = 0;
+            _tauRate = vStart;
+        }
+        double realDuration() const {
+            return _realDuration;
+        }
+        //the constant-velocity time at real time t (0 <= t <= realDuration(), and no less than the last t asked for)
+        double at(AccelProfile &profile, double t) {
+            //find tau such that profile.transform(tau) == t, by regula falsi (Illinois variant).
+            //tau at the previous point bounds it from below, and extrapolating the rate there gives a good first guess, so usually only one or two calls to transform() are needed.
+            double lo = _tauHint, rLo = _realHint - t;
+            double hi = _duration, rHi = _realDuration - t;
+            double tau = lo + _tauRate*(t - _realHint);
+            double r = 0;
+            int side = 0;
+            for (int i=0; i<32; ++i) {
+                if (!(tau > lo && tau < hi)) {
+                    tau = 0.5*(lo + hi);
+                }
+                r = profile.transform(_time(tau)).count()*1e-9 - t;
+                if (r < 0) {
+                    lo = tau; rLo = r;
+                    if (side < 0) {
+                        rHi *= 0.5;
+                    }
+                    side = -1;
+                } else {
+                    hi = tau; rHi = r;
+                    if (side > 0) {
+                        rLo *= 0.5;
+                    }
+                    side = 1;
+                }
+                if (std::fabs(r) < 1e-9 || hi - lo < 1e-9) { //transform() is only resolved to the nanosecond
+                    break;
+                }
+                tau = lo - rLo*(hi - lo)/(rHi - rLo);
+            }
+            tau = r < 0 ? lo : hi; //the last point evaluated
+            if (t > _realHint) {
+                _tauRate = (tau - _tauHint)/(t - _realHint);
+            }
+            _tauHint = tau; //never more than a nanosecond beyond t, so it's still a lower bound for the next point
+            _realHint = t + r;
+            return tau;
+        }
+    private:
+        static StepTimeT _time(double seconds) {
+            return StepTimeT((StepTimeT::rep)(seconds*1e9 + 0.5));
+        }
+};
+
+#endif
@@ -26,16 +26,72 @@
  *
  * MotionPlanner takes commands from the State (mainly those caused by G1 and G28) and resolves the move into a path via interfacing with a CoordMap, AxisSteppers, and an AccelerationProfile.
  * Once a path is planned, State can call MotionPlanner.nextStep() and be given data in the form of an Event, which can be passed on to a Scheduler.
+ *
+ * Linear moves are buffered in a queue of MotionSegments so that the planner can look ahead and blend consecutive moves without coming to a stop at each joint.
+ * Each time a segment is queued, every segment that hasn't yet begun stepping is re-planned:
+ *   The maximum velocity at each joint is limited by the angle between the two segments (via the "junction deviation" method used in Grbl),
+ *   then a backward pass ensures that the machine can always decelerate to a stop by the end of the last queued segment,
+ *   and a forward pass ensures that no segment is asked to enter faster than the previous one can accelerate to.
+ * The segment currently being stepped keeps the entry & exit velocities it was given when it began.
+ *
+ * Arcs (G2/G3) are planned as a single segment, provided that every AxisStepper can follow an ArcPath (see supportsArcs()).
+ * Their speed is additionally limited so that the centripetal acceleration doesn't exceed maxAccel, and junctions use the tangent at either end of the arc.
+ *
+ * Each mechanical axis may have its own velocity & acceleration limits (see setAxisLimits). For each move, the planner finds the
+ *   fastest velocity & acceleration at which no axis exceeds its limits anywhere along the path, so a move is only slowed by the axes it actually loads.
+ *   This matters most for deltas, whose carriages move much faster than the effector near the edge of the build plate.
+ *
+ * With pressure advance, the extruder is driven ahead of its nominal position by K*(its velocity), where K (seconds) is given with each move.
+ *   The nozzle pressure lags the extruder by roughly this much, so without it the flow starves as the toolhead accelerates and bulges the corners as it decelerates.
+ *   The extruder's velocity follows the toolhead's through every phase of the AccelerationProfile, so its position is tabulated over the move as an ExtrusionPath.
  * 
+ * The steppers & acceleration profile of a segment are kept in a StepperSet. There are two, so that while one segment is being stepped,
+ *   the next can be prepared in the other whenever the State is idle (see prepareNextSegment), and beginning it is just a pointer swap.
+ *   This relies on predicting the mechanical position at which the current segment ends. If that turns out to be wrong, the next segment is prepared as it begins, as it would be without the second set.
+ *
+ * With input shaping (the Shaper parameter; see motion/inputshaper.h), the commanded path is instead sampled at nodes a fixed time apart, as the AccelerationProfile
+ *   would follow it, and the AxisSteppers follow straight chords between the shaped nodes. The shaping carries across the joints between segments,
+ *   so the corners are shaped as well as the acceleration along each segment. A segment can't be replanned once the nodes reach it.
+ *   Homing isn't shaped, and segments aren't prepared ahead of time (there's little to prepare).
+ *
  * Interface must have 2 public typedefs: CoordMapT and AxisStepperTypes. These are often provided by the machine driver.
  */
 #ifndef MOTION_MOTIONPLANNER_H
 #define MOTION_MOTIONPLANNER_H
 
 #include <array>
+#include <algorithm> //for min, max
+#include <cmath> //for sqrt
+#include <cstddef> //for size_t
 #include "accelerationprofile.h"
+#include "inputshaper.h"
 #include "drivers/axisstepper.h"
 #include "event.h"
+#include "common/ringbuffer.h"
+
+#ifndef MOTION_PLANNER_QUEUE_LEN
+    #define MOTION_PLANNER_QUEUE_LEN 16 //number of linear moves that can be buffered (and planned across) at once
+#endif
+
+#ifndef MOTION_PLANNER_PREDICTION_MARGIN
+    #define MOTION_PLANNER_PREDICTION_MARGIN 0.01 //steps. The next segment isn't prepared early if the current one ends this close to a whole step of any moving axis
+#endif
+
+#ifndef MOTION_PLANNER_CHORD_STEP_MARGIN
+    #define MOTION_PLANNER_CHORD_STEP_MARGIN 0.01 //steps. With input shaping, a step this close to the start of a chord is taken as it begins (see _nextChord)
+#endif
+
+#ifndef MOTION_PLANNER_AXIS_LIMIT_SAMPLES
+    #define MOTION_PLANNER_AXIS_LIMIT_SAMPLES 5 //number of points along each move (including either end) at which the speed of each axis is checked against its limits
+#endif
+
+#ifndef MOTION_PLANNER_AXIS_CURVATURE_DIST
+    #define MOTION_PLANNER_AXIS_CURVATURE_DIST 0.1 //mm. The curvature of the path in each axis' coordinates is found from its velocity at points this far apart about each sample
+#endif
+
+#ifndef MOTION_PLANNER_AXIS_CURVATURE_SHARE
+    #define MOTION_PLANNER_AXIS_CURVATURE_SHARE 0.5 //greatest fraction of an axis' acceleration limit that following the curvature of the path may take up, at full speed
+#endif
 
 enum MotionType {
     MotionNone,
@@ -43,60 +99,157 @@ enum MotionType {
     MotionHome
 };
 
-template <typename Interface, typename AccelProfile=NoAcceleration> class MotionPlanner {
+//A linear move (or arc) that has been accepted by the MotionPlanner, but which may not yet have begun stepping.
+struct MotionSegment {
+    float x, y, z, e; //destination, in cartesian coordinates (after leveling & bounding)
+    float ux, uy, uz; //unit vector in the direction of travel at the start of the move (all zero for extrusion-only moves)
+    float exitUx, exitUy, exitUz; //unit vector in the direction of travel at the end of the move (same as ux, uy, uz unless this is an arc)
+    bool isArc;
+    float centerX, centerY; //center of the arc (only if isArc)
+    float startAngle, arcAngle; //angle of the start position about the center, and the (signed) angle swept by the arc. Positive is counter-clockwise (only if isArc)
+    float dist; //length of the move, in mm (not including extrusion)
+    float duration; //duration of the move if it were carried out entirely at nominalVel
+    float nominalVel; //the desired cartesian velocity, in mm/sec
+    float accelLimit; //the greatest cartesian acceleration that every axis can follow (in mm/sec^2), in addition to the AccelerationProfile's own limit
+    float velE; //the extrusion rate at nominalVel, in mm/sec
+    float pressureAdvance; //K, in seconds. 0 disables pressure advance
+    float maxEntryVel; //limit placed on entryVel by the angle of the joint with the previous segment
+    float entryVel; //planned velocity at the start of the move. The exit velocity is the next segment's entryVel (or 0 if there is no next segment)
+    EventClockT::duration baseTime; //earliest time at which this move may begin (only relevant if it is entered from rest)
+};
+
+template <typename Interface, typename AccelProfile=NoAcceleration, typename Shaper=NoInputShaper> class MotionPlanner {
     private:
         typedef typename Interface::CoordMapT CoordMapT;
         typedef typename Interface::AxisStepperTypes AxisStepperTypes;
         typedef typename drv::AxisStepper::GetHomeStepperTypes<AxisStepperTypes>::HomeStepperTypes HomeStepperTypes;
+        //a shaped path is stepped in chords, and the steps that land just before the start of a chord are caught up on from each axis' mechanicalPositionAt.
+        static_assert(!InputShaper<Shaper>::isEnabled() || drv::AxisStepper::ReportsPositions<AxisStepperTypes>::value, 
+            "Input shaping requires every AxisStepper to override mechanicalPositionAt; otherwise steps are lost between chords");
         CoordMapT _coordMapper; //object that maps from (x, y, z) to mechanical coords (eg A, B, C for a kossel)
-        AccelProfile _accel; //transforms the constant-velocity motion stream into one that considers acceleration
         std::array<int, CoordMapT::numAxis()> _destMechanicalPos; //the mechanical position of the last step that was scheduled
-        AxisStepperTypes _iters; //Each axis iterator reports the next time it needs to be stepped. _iters is for linear movement
+        float _destX, _destY, _destZ, _destE; //the cartesian position commanded by the last segment to begin (the mechanical position may differ from it by step rounding)
+        std::array<float, CoordMapT::numAxis()> _maxAxisVel; //velocity limit of each mechanical axis, in mm/sec
+        std::array<float, CoordMapT::numAxis()> _maxAxisAccel; //acceleration limit of each mechanical axis, in mm/sec^2
+        //Everything needed to step one segment. There are two sets, so that the segment after the current one can be prepared during idle time (see prepareNextSegment),
+        //  and beginning it is then just a matter of swapping the two.
+        struct StepperSet {
+            AxisStepperTypes iters; //Each axis iterator reports the next time it needs to be stepped
+            AccelProfile accel; //transforms the constant-velocity motion stream into one that considers acceleration
+            drv::ExtrusionPath extrusionPath; //path followed by the extruder(s), when pressure advance is in use
+            StepTimeT duration; //the estimated duration of the segment, not taking into account acceleration
+            float exitVel; //the velocity at which the segment will be exited
+            std::array<int, CoordMapT::numAxis()> startPos; //the mechanical position from which the segment was prepared to begin
+            float startX, startY, startZ, startE; //the commanded cartesian position at which the segment begins
+            float destX, destY, destZ, destE; //the commanded cartesian position at which it ends (E may include some held pressure advance)
+            StepperSet() : iters(), accel(), extrusionPath(), duration(drv::AxisStepper::noStep()), exitVel(0), startPos() {}
+        };
+        std::array<StepperSet, 2> _stepperSets;
+        StepperSet *_cur; //the set of the segment being stepped. Its accel is also used while homing.
+        StepperSet *_next; //the set in which the following segment is prepared
+        bool _isNextPrepared; //true if _next already holds the segment after the current one (though it's only used if it was prepared from the right mechanical position)
+        bool _isEndUnpredictable; //true if the current segment ends too near a whole step to tell which side of it the axis will stop
+        bool _canPredictEnd; //false if any AxisStepper can't report its mechanicalPositionAt, in which case segments are only prepared as they begin
         HomeStepperTypes _homeIters; //Axis iterators used when homing
+        bool _isBackingOff; //true if the current homing motion is backing the axes off of their endstops, rather than homing to them
+        RingBuffer<MotionSegment, MOTION_PLANNER_QUEUE_LEN> _segments; //queued linear moves. If _motionType == MotionLinear, then the front segment is the one being stepped.
         EventClockT::duration _baseTime; //The time at which the current path segment began (this will be a fraction of a second before the time which the first step in this path is scheduled for)
-        float _duration; //the estimated duration of the current piece, not taking into account acceleration
+        EventClockT::duration _endTime; //The time at which the last completed path segment ended
         MotionType _motionType; //which type of segment is being planned
+        //Input shaping (only if isShaped()):
+        InputShaper<Shaper> _shaper; //the commanded position at the last few nodes
+        AccelerationProfileInverse<AccelProfile> _profileInverse; //finds how far along the front segment the commanded position is at each node
+        drv::ArcPath _sampledArc; //path of the front segment, if it's an arc (radius is 0 otherwise)
+        bool _isSampling; //true if the nodes have reached the front segment (whose profile is then in _cur)
+        EventClockT::duration _nodeTime; //time of the last node sampled
+        typename InputShaper<Shaper>::Position _shapedPos; //the shaped position at the last node, where the chord being stepped ends
+        EventClockT::duration _chordBaseTime; //time at which the chord being stepped begins
+        std::array<int, CoordMapT::numAxis()> _catchUpSteps; //steps that an axis must take at the start of the chord, to rejoin the path (see _nextChord)
     public:
         MotionPlanner() : 
-            _accel(), 
             _destMechanicalPos(), 
-            _iters(), _homeIters(), 
+            _destX(0), _destY(0), _destZ(0), _destE(0),
+            _maxAxisVel(), _maxAxisAccel(),
+            _stepperSets(),
+            _cur(&_stepperSets[0]), _next(&_stepperSets[1]),
+            _isNextPrepared(false),
+            _isEndUnpredictable(false),
+            _canPredictEnd(true),
+            _homeIters(), 
+            _isBackingOff(false),
+            _segments(),
             _baseTime(), 
-            _duration(NAN),
+            _endTime(),
             //_maxVel(0), 
-            _motionType(MotionNone) {}
+            _motionType(MotionNone),
+            _shaper(),
+            _profileInverse(),
+            _sampledArc(),
+            _isSampling(false),
+            _nodeTime(),
+            _shapedPos(),
+            _chordBaseTime(),
+            _catchUpSteps() {
+                _maxAxisVel.fill(INFINITY);
+                _maxAxisAccel.fill(INFINITY);
+                std::tie(_destX, _destY, _destZ, _destE) = CoordMapT::xyzeFromMechanical(_destMechanicalPos);
+                std::array<float, CoordMapT::numAxis()> pos;
+                pos.fill(0);
+                drv::AxisStepper::mechanicalPositionsAt<AxisStepperTypes>(pos, 0, 0, 0, 0);
+                for (float p : pos) {
+                    _canPredictEnd = _canPredictEnd && !std::isnan(p);
+                }
+            }
+        void setAxisLimits(std::size_t axis, float maxVel, float maxAccel) {
+            //limit the velocity (mm/sec) & acceleration (mm/sec^2) of the given mechanical axis (eg a delta tower's carriage, or an extruder) in all future moves.
+            _maxAxisVel[axis] = maxVel;
+            _maxAxisAccel[axis] = maxAccel;
+        }
         bool readyForNextMove() const {
-            //returns true if a call to moveTo() or homeEndstops() wouldn't hang, false if it would hang (or cause other problems)
-            //Note: for now, there isn't actually buffering.
-            return _motionType == MotionNone;
+            //returns true if a call to moveTo() wouldn't hang, false if it would hang (or cause other problems)
+            return _motionType != MotionHome && !_segments.full();
+        }
+        bool readyForNextHome() const {
+            //returns true if a call to homeEndstops() wouldn't hang. Homing can only begin once all queued moves have been completed.
+            return _motionType == MotionNone && _segments.empty();
+        }
+        static constexpr bool isShaped() {
+            //true if the commanded path is input shaped
+            return InputShaper<Shaper>::isEnabled();
         }
     private:
         Event _nextStep(drv::AxisStepper &s, bool isHoming) {
-            LOGV("MotionPlanner::nextStep() is: %i at %g of %g\n", s.index(), s.time, _duration);
-            if (s.time > _duration || s.time <= 0 || std::isnan(s.time)) { //if the next time the given axis wants to step is invalid or past the movement length, then end the motion
-                //Note: don't combine s.time <= 0 || isnan(s.time) to !(s.time > 0) because that might be broken during optimizations.
+            LOGV("MotionPlanner::nextStep() is: %i at %lld of %lld ns\n", s.index(), (long long)s.time.count(), (long long)_cur->duration.count());
+            if (s.time > _cur->duration || s.time <= StepTimeT::zero() || s.time == drv::AxisStepper::noStep()) { //if the next time the given axis wants to step is invalid or past the movement length, then end the motion
                 //Note: This conditional causes the MotionPlanner to always undershoot the desired position, when it may be desireable to overshoot some of them - see https://github.com/Wallacoloo/printipi/issues/15
                 if (isHoming) { 
-                    //if homing, then we now know the axis mechanical positions; fetch them
-                    _destMechanicalPos = CoordMapT::getHomePosition(_destMechanicalPos);
+                    //if homing, then we now know the axis mechanical positions; fetch them (after backing off, they're still known relative to the endstops).
+                    //This is the only place the cartesian position needs to be found from the mechanical one.
+                    if (!_isBackingOff) {
+                        _destMechanicalPos = CoordMapT::getHomePosition(_destMechanicalPos);
+                    }
+                    std::tie(_destX, _destY, _destZ, _destE) = CoordMapT::xyzeFromMechanical(_destMechanicalPos);
+                    _endTime = _baseTime;
+                } else {
+                    //the next segment (if it's blended with this one) must begin exactly where this one ends:
+                    _endTime = _baseTime + std::chrono::duration_cast<EventClockT::duration>(_cur->accel.transform(_cur->duration));
+                    _segments.pop_front();
                 }
                 //log debug info:
-                float x, y, z, e;
-                std::tie(x, y, z, e) = CoordMapT::xyzeFromMechanical(_destMechanicalPos);
-                LOGD("MotionPlanner::moveTo Got (x,y,z,e) %f, %f, %f, %f\n", x, y, z, e);
+                LOGD("MotionPlanner::_nextStep segment ended at (x,y,z,e) %f, %f, %f, %f\n", _destX, _destY, _destZ, _destE);
                 LOGD("MotionPlanner _destMechanicalPos: (%i, %i, %i, %i)\n", _destMechanicalPos[0], _destMechanicalPos[1], _destMechanicalPos[2], _destMechanicalPos[3]);
                 _motionType = MotionNone; //motion is over.
-                return Event();
+                return nextStep(); //continue directly into the next queued segment, if there is one.
             }
-            float transformedTime = _accel.transform(s.time); //transform the step time according to acceleration profile
-            LOGV("Step transformed time: %f\n", transformedTime);
+            StepTimeT transformedTime = _cur->accel.transform(s.time); //transform the step time according to acceleration profile
+            LOGV("Step transformed time: %lld ns\n", (long long)transformedTime.count());
             Event e = s.getEvent(transformedTime);
             e.offset(_baseTime); //AxisSteppers report times relative to the start of motion; transform to absolute.
             _destMechanicalPos[s.index()] += stepDirToSigned<int>(s.direction); //update the mechanical position tracked in software
             if (isHoming) {
                 s.nextStep(_homeIters); //advance the respective AxisStepper to its next step.
             } else {
-                s.nextStep(_iters);
+                s.nextStep(_cur->iters);
             }
             return e;
         }
@@ -110,77 +263,658 @@ template <typename Interface, typename AccelProfile=NoAcceleration> class Motion
             return Event();
         }
         template <bool T> Event _nextStepMoving(std::integral_constant<bool, T> ) {
-            return _nextStep(drv::AxisStepper::getNextTime(_iters), false);
+            return _nextStep(drv::AxisStepper::getNextTime(_cur->iters), false);
         }
         Event _nextStepMoving(std::false_type ) {
             return Event();
         }
+        Event _nextShapedStep(std::true_type) {
+            //the next step along the chords between shaped nodes
+            while (true) {
+                for (std::size_t axis=0; axis<_catchUpSteps.size(); ++axis) {
+                    if (_catchUpSteps[axis]) {
+                        StepDirection dir = _catchUpSteps[axis] > 0 ? StepForward : StepBackward;
+                        _catchUpSteps[axis] -= stepDirToSigned<int>(dir);
+                        _destMechanicalPos[axis] += stepDirToSigned<int>(dir);
+                        Event e = Event::StepperEvent(StepTimeT::zero(), axis, dir);
+                        e.offset(_chordBaseTime);
+                        return e;
+                    }
+                }
+                drv::AxisStepper &s = drv::AxisStepper::getNextTime(_cur->iters);
+                if (s.time > StepTimeT::zero() && s.time <= _nodeSpacing()) {
+                    Event e = s.getEvent(s.time); //the chord is followed at constant velocity
+                    e.offset(_chordBaseTime);
+                    _destMechanicalPos[s.index()] += stepDirToSigned<int>(s.direction);
+                    s.nextStep(_cur->iters);
+                    return e;
+                }
+                if (!_nextChord()) {
+                    return Event();
+                }
+            }
+        }
+        Event _nextShapedStep(std::false_type) {
+            return Event();
+        }
+        bool _nextChord() {
+            //Sample the commanded path at the next node, and begin the chord to its shaped position.
+            //Returns false (and ends the motion) once the shaped path has come to rest with nothing more queued.
+            if (_shaper.isSettled() && !_isSampling) {
+                if (_segments.empty()) {
+                    LOGD("MotionPlanner shaped motion came to rest at (%f, %f, %f, %f)\n", _destX, _destY, _destZ, _destE);
+                    _motionType = MotionNone;
+                    return false;
+                }
+                _restartShaping(); //rather than sampling the rest position until the next segment may begin
+            }
+            EventClockT::duration prevNodeTime = _nodeTime;
+            _nodeTime += _nodeSpacing();
+            typename InputShaper<Shaper>::Position shaped = _shaper.push(_sample(_nodeTime, prevNodeTime));
+            if (shaped != _shapedPos) { //(otherwise the AxisSteppers are already past the end of the chord)
+                //Each chord begins where the last one ended, but a step that lies (almost) exactly on the joint may be placed just after the end of one chord
+                //  and just before the start of the next by rounding, and so be missed by both. The axis would then never catch up with the path,
+                //  as an AxisStepper only looks for the next whole step either side of where it begins. So any step that near the joint is taken as the chord begins.
+                std::array<float, CoordMapT::numAxis()> start, end;
+                drv::AxisStepper::mechanicalPositionsAt<AxisStepperTypes>(start, _shapedPos[0], _shapedPos[1], _shapedPos[2], _shapedPos[3]);
+                drv::AxisStepper::mechanicalPositionsAt<AxisStepperTypes>(end, shaped[0], shaped[1], shaped[2], shaped[3]);
+                std::array<int, CoordMapT::numAxis()> startPos = _destMechanicalPos;
+                for (std::size_t axis=0; axis<start.size(); ++axis) {
+                    //(none of these hold if the axis can't tell its position)
+                    int target = startPos[axis];
+                    if (end[axis] > start[axis] && start[axis] > startPos[axis] + 1 - MOTION_PLANNER_CHORD_STEP_MARGIN) {
+                        target = (int)std::floor(start[axis] + MOTION_PLANNER_CHORD_STEP_MARGIN);
+                    } else if (end[axis] < start[axis] && start[axis] < startPos[axis] - 1 + MOTION_PLANNER_CHORD_STEP_MARGIN) {
+                        target = (int)std::ceil(start[axis] - MOTION_PLANNER_CHORD_STEP_MARGIN);
+                    } else if (std::fabs(start[axis] - startPos[axis]) >= 1) {
+                        target = (int)std::lround(start[axis]);
+                    }
+                    _catchUpSteps[axis] = target - startPos[axis];
+                    startPos[axis] = target;
+                }
+                float dt = drv::AxisStepper::secondsFromTime(_nodeSpacing());
+                drv::AxisStepper::initAxisSteppers(_cur->iters, startPos, _shapedPos[0], _shapedPos[1], _shapedPos[2], _shapedPos[3],
+                    (shaped[0]-_shapedPos[0])/dt, (shaped[1]-_shapedPos[1])/dt, (shaped[2]-_shapedPos[2])/dt, (shaped[3]-_shapedPos[3])/dt);
+                _chordBaseTime = prevNodeTime;
+                _shapedPos = shaped;
+            }
+            return true;
+        }
+        static EventClockT::duration _nodeSpacing() {
+            //time between nodes, rounded to the resolution of the clock so that every node (and chord) begins exactly on it
+            return std::chrono::duration_cast<EventClockT::duration>(InputShaper<Shaper>::nodeSpacing());
+        }
+        void _restartShaping() {
+            //Start the nodes over from rest at the commanded position, when the front segment may begin.
+            _nodeTime = std::max(_nodeTime, std::max(_endTime, _segments.front().baseTime));
+            _shapedPos = {{ _destX, _destY, _destZ, _destE }};
+            _shaper.reset(_shapedPos);
+            _motionType = MotionLinear;
+        }
+        typename InputShaper<Shaper>::Position _sample(EventClockT::duration time, EventClockT::duration prevNodeTime) {
+            //the commanded (unshaped) position at the given time, which is a node after prevNodeTime. Segments are begun (and ended) as the nodes reach them.
+            while (!_segments.empty()) {
+                if (!_isSampling) {
+                    const MotionSegment &seg = _segments.front();
+                    //if blended with the previous segment, there must be no gap between them. Otherwise, it can't start before it was queued, nor before the nodes already sampled.
+                    EventClockT::duration start = seg.entryVel > 0 ? _endTime : std::max(prevNodeTime, std::max(_endTime, seg.baseTime));
+                    if (start > time) {
+                        break;
+                    }
+                    _beginSampling(start);
+                }
+                double real = std::chrono::duration<double>(time - _baseTime).count();
+                if (real < _profileInverse.realDuration()) {
+                    return _pathAt(_profileInverse.at(_cur->accel, real));
+                }
+                //the nodes are past the end of the segment:
+                _endTime = _baseTime + std::chrono::duration_cast<EventClockT::duration>(_cur->accel.transform(_cur->duration));
+                std::tie(_destX, _destY, _destZ, _destE) = std::make_tuple(_cur->destX, _cur->destY, _cur->destZ, _cur->destE);
+                _segments.pop_front();
+                _isSampling = false;
+            }
+            return {{ _destX, _destY, _destZ, _destE }}; //at rest
+        }
+        void _beginSampling(EventClockT::duration baseTime) {
+            //Begin the segment at the front of the queue, as the nodes reach it (with input shaping, this takes the place of _beginSegment).
+            const MotionSegment &seg = _segments.front();
+            StepperSet &set = *_cur;
+            float exitVel = _segments.size() > 1 ? _segments[1].entryVel : 0;
+            std::tie(set.startX, set.startY, set.startZ, set.startE) = std::make_tuple(_destX, _destY, _destZ, _destE);
+            _sampledArc = _arcPath(seg, _destX, _destY, _destZ, _destE);
+            set.exitVel = exitVel;
+            set.accel.begin(seg.duration, seg.nominalVel, seg.entryVel, exitVel, seg.accelLimit);
+            std::tie(set.destX, set.destY, set.destZ, set.destE) = std::make_tuple(seg.x, seg.y, seg.z, seg.e);
+            if (_usesPressureAdvance(seg)) {
+                _planExtrusionPath(set, seg);
+                set.destE = set.startE + set.extrusionPath.dist.back();
+            }
+            set.duration = drv::AxisStepper::timeFromSeconds(seg.duration);
+            _profileInverse.begin(set.accel, seg.duration, seg.nominalVel > 0 ? seg.entryVel/seg.nominalVel : 0);
+            this->_baseTime = baseTime;
+            _isSampling = true;
+            LOGD("MotionPlanner::beginSampling (%f, %f, %f, %f) -> (%f, %f, %f, %f)\n", set.startX, set.startY, set.startZ, set.startE, seg.x, seg.y, seg.z, seg.e);
+            LOGD("MotionPlanner::beginSampling V:%f, Ventry:%f, Vexit:%f, dur:%f\n", seg.nominalVel, seg.entryVel, exitVel, seg.duration);
+        }
+        typename InputShaper<Shaper>::Position _pathAt(float tau) const {
+            //the commanded position at constant-velocity time tau (seconds) into the segment being sampled
+            const StepperSet &set = *_cur;
+            const MotionSegment &seg = _segments.front();
+            float frac = tau/seg.duration;
+            float e = _usesPressureAdvance(seg) ? set.startE + _extrusionAt(set.extrusionPath, tau) : set.startE + frac*(set.destE-set.startE);
+            if (_sampledArc.radius > 0) {
+                float angle = _sampledArc.startAngle + _sampledArc.angularVel*tau;
+                return {{ _sampledArc.centerX + _sampledArc.radius*std::cos(angle), _sampledArc.centerY + _sampledArc.radius*std::sin(angle), _sampledArc.z0 + _sampledArc.vz*tau, e }};
+            }
+            return {{ set.startX + frac*(set.destX-set.startX), set.startY + frac*(set.destY-set.startY), set.startZ + frac*(set.destZ-set.startZ), e }};
+        }
+        static float _extrusionAt(const drv::ExtrusionPath &path, float t) {
+            //the extruder's displacement along the path at (constant-velocity) time t, interpolated linearly between samples
+            std::size_t i = std::upper_bound(path.time.begin(), path.time.end(), t) - path.time.begin();
+            if (i == 0) {
+                return path.dist.front();
+            } else if (i == path.time.size()) {
+                return path.dist.back();
+            }
+            float frac = (t - path.time[i-1])/(path.time[i] - path.time[i-1]);
+            return path.dist[i-1] + frac*(path.dist[i] - path.dist[i-1]);
+        }
+        void _beginSegment() {
+            //Begin stepping the segment at the front of the queue.
+            const MotionSegment &seg = _segments.front();
+            float exitVel = _segments.size() > 1 ? _segments[1].entryVel : 0;
+            if (!_isNextPrepared || _next->startPos != _destMechanicalPos) {
+                if (_isNextPrepared) {
+                    LOGD("MotionPlanner::beginSegment the previous segment didn't end where predicted; preparing the next one again\n");
+                }
+                //The segment begins at the previous segment's commanded destination, rather than at the (forward kinematics of the) mechanical position.
+                //  The AxisSteppers are given both, and step wherever the commanded path crosses a whole step, so step rounding never accumulates.
+                _prepareSteppers(*_next, seg, _destMechanicalPos, _destX, _destY, _destZ, _destE);
+                _prepareProfile(*_next, seg, exitVel);
+            } else if (_next->exitVel != exitVel) {
+                _prepareProfile(*_next, seg, exitVel); //moves queued since it was prepared have changed how fast it can be exited.
+            }
+            std::swap(_cur, _next);
+            _isNextPrepared = false;
+            _isEndUnpredictable = false;
+            //if we're blended with the previous segment, then there must be no gap between them. Otherwise, we can't start before the move was queued.
+            this->_baseTime = seg.entryVel > 0 ? _endTime : std::max(_endTime, seg.baseTime);
+            LOGD("MotionPlanner::beginSegment (%f, %f, %f, %f) -> (%f, %f, %f, %f)\n", _cur->startX, _cur->startY, _cur->startZ, _cur->startE, seg.x, seg.y, seg.z, seg.e);
+            LOGD("MotionPlanner::beginSegment _destMechanicalPos: (%i, %i, %i, %i)\n", _destMechanicalPos[0], _destMechanicalPos[1], _destMechanicalPos[2], _destMechanicalPos[3]);
+            LOGD("MotionPlanner::beginSegment V:%f, Ventry:%f, Vexit:%f, dur:%f\n", seg.nominalVel, seg.entryVel, exitVel, seg.duration);
+            std::tie(_destX, _destY, _destZ, _destE) = std::make_tuple(_cur->destX, _cur->destY, _cur->destZ, _cur->destE);
+            this->_motionType = MotionLinear;
+        }
+        void _prepareSteppers(StepperSet &set, const MotionSegment &seg, const std::array<int, CoordMapT::numAxis()> &startPos, float curX, float curY, float curZ, float curE) {
+            //Initialize the AxisSteppers of the set to carry out seg, from the given mechanical & (commanded) cartesian positions.
+            //Anything that depends upon the acceleration profile is left to _prepareProfile.
+            set.startPos = startPos;
+            std::tie(set.startX, set.startY, set.startZ, set.startE) = std::make_tuple(curX, curY, curZ, curE);
+            float vx = (seg.x-curX)/seg.duration;
+            float vy = (seg.y-curY)/seg.duration;
+            float vz = (seg.z-curZ)/seg.duration;
+            float velE = (seg.e-curE)/seg.duration;
+            drv::ArcPath arc = _arcPath(seg, curX, curY, curZ, curE);
+            if (arc.radius > 0) {
+                _initAxisArcSteppers(set, arc, std::integral_constant<bool, supportsArcs()>());
+            } else {
+                drv::AxisStepper::initAxisSteppers(set.iters, startPos, curX, curY, curZ, curE, vx, vy, vz, velE);
+            }
+        }
+        static drv::ArcPath _arcPath(const MotionSegment &seg, float curX, float curY, float curZ, float curE) {
+            //the arc followed by seg from the given (commanded) cartesian position. Its radius is 0 if seg isn't an arc.
+            drv::ArcPath arc;
+            arc.radius = seg.isArc ? std::hypot(curX-seg.centerX, curY-seg.centerY) : 0;
+            if (arc.radius > 0) {
+                arc.centerX = seg.centerX;
+                arc.centerY = seg.centerY;
+                //atan2 wraps at +/-pi, so take whichever equivalent angle is nearest the one that was planned:
+                arc.startAngle = std::atan2(curY-seg.centerY, curX-seg.centerX);
+                arc.startAngle += TWO_PI()*std::round((seg.startAngle - arc.startAngle)/TWO_PI());
+                arc.angularVel = (seg.startAngle + seg.arcAngle - arc.startAngle)/seg.duration;
+                arc.z0 = curZ;
+                arc.e0 = curE;
+                arc.vz = (seg.z-curZ)/seg.duration;
+                arc.ve = (seg.e-curE)/seg.duration;
+            }
+            return arc;
+        }
+        void _prepareProfile(StepperSet &set, const MotionSegment &seg, float exitVel) {
+            //Begin the set's acceleration profile for seg (whose steppers have been prepared), to be exited at exitVel.
+            //This may be called again if exitVel changes before the segment begins.
+            set.exitVel = exitVel;
+            set.accel.begin(seg.duration, seg.nominalVel, seg.entryVel, exitVel, seg.accelLimit);
+            std::tie(set.destX, set.destY, set.destZ, set.destE) = std::make_tuple(seg.x, seg.y, seg.z, seg.e);
+            if (_usesPressureAdvance(seg)) {
+                _planExtrusionPath(set, seg);
+                drv::AxisStepper::followExtrusionPath(set.iters, set.extrusionPath);
+                set.destE = set.startE + set.extrusionPath.dist.back(); //the extruder ends up holding some advance, which the next segment must begin from
+            }
+            set.duration = drv::AxisStepper::timeFromSeconds(seg.duration);
+        }
+        static bool _usesPressureAdvance(const MotionSegment &seg) {
+            return seg.pressureAdvance > 0 && seg.velE != 0 && seg.dist > 0;
+        }
+        bool _predictEndPosition(std::array<int, CoordMapT::numAxis()> &endPos) const {
+            //Predict the mechanical position at which the current segment will leave the axes, without stepping it.
+            //Each axis steps wherever the commanded path crosses a whole step, so it ends at the last whole step it reaches (in the direction it's moving as the segment ends).
+            //  A path that ends (almost) exactly on a step may or may not take it, depending on rounding, so no prediction is made.
+            //Returns false if no prediction can be made. If it turns out to be wrong, the next segment is simply prepared again as it begins.
+            const StepperSet &set = *_cur;
+            const MotionSegment &seg = _segments.front();
+            std::array<float, CoordMapT::numAxis()> start, end;
+            drv::AxisStepper::mechanicalPositionsAt<AxisStepperTypes>(start, set.startX, set.startY, set.startZ, set.startE);
+            drv::AxisStepper::mechanicalPositionsAt<AxisStepperTypes>(end, set.destX, set.destY, set.destZ, set.destE);
+            std::array<float, CoordMapT::numAxis()> vel = CoordMapT::mechanicalVelocity(std::make_tuple(set.destX, set.destY, set.destZ),
+                std::make_tuple(seg.exitUx, seg.exitUy, seg.exitUz, set.destE - set.startE));
+            for (std::size_t i=0; i<std::tuple_size<AxisStepperTypes>::value; ++i) {
+                if (std::isnan(start[i]) || std::isnan(end[i])) {
+                    return false;
+                }
+                if (vel[i] != 0 && std::fabs(end[i] - std::round(end[i])) < MOTION_PLANNER_PREDICTION_MARGIN) {
+                    return false;
+                } else if (vel[i] > 0) {
+                    endPos[i] = (int)std::floor(end[i]);
+                    if (start[i] <= end[i]) {
+                        endPos[i] = std::max(endPos[i], set.startPos[i]); //the axis may already be ahead of the path by a fraction of a step
+                    }
+                } else if (vel[i] < 0) {
+                    endPos[i] = (int)std::ceil(end[i]);
+                    if (start[i] >= end[i]) {
+                        endPos[i] = std::min(endPos[i], set.startPos[i]);
+                    }
+                } else {
+                    endPos[i] = set.startPos[i];
+                }
+            }
+            return true;
+        }
+        void _planExtrusionPath(StepperSet &set, const MotionSegment &seg) {
+            //Tabulate the extruder's position over the segment with pressure advance (the set's profile must already have begun the segment).
+            //The extruder leads its nominal position by advance(t) = K*velE*velocityRatio(t), where velocityRatio is the toolhead's velocity relative to nominalVel.
+            //Whatever advance was held at the end of the previous segment is already reflected in the segment's start, so aim for seg.e plus the advance at exit,
+            //  spreading any difference in the advance across the joint over the whole segment.
+            //The extruder never reverses within the segment: any retraction that deceleration would call for is put off until the next one.
+            drv::ExtrusionPath &path = set.extrusionPath;
+            const std::size_t numSamples = path.dist.size();
+            float curE = set.startE;
+            float advanceEntry = seg.pressureAdvance*seg.velE*_velocityRatio(set.accel, 0, seg.duration);
+            float velE = (seg.e - curE + advanceEntry)/seg.duration; //velocity of the unadvanced motion
+            float dir = seg.e - curE + seg.pressureAdvance*seg.velE*_velocityRatio(set.accel, seg.duration, seg.duration) < 0 ? -1 : 1;
+            float reached = 0;
+            for (std::size_t i=0; i<numSamples; ++i) {
+                //the samples are concentrated toward either end of the segment, where the toolhead accelerates & decelerates.
+                float u = (float)i/(numSamples-1);
+                float t = seg.duration*u*u*(3-2*u);
+                float dist = velE*t + seg.pressureAdvance*seg.velE*_velocityRatio(set.accel, t, seg.duration) - advanceEntry;
+                reached = dir*dist > dir*reached ? dist : reached;
+                path.time[i] = t;
+                path.dist[i] = reached;
+            }
+            LOGD("MotionPlanner::planExtrusionPath velE:%f, advanceEntry:%f, dist:%f\n", velE, advanceEntry, reached);
+        }
+        static float _velocityRatio(AccelProfile &accel, float t, float duration) {
+            //the toolhead's velocity at (constant-velocity) time t within a segment, relative to nominalVel, according to the profile that has begun it.
+            //This is the rate at which t advances relative to the real time, estimated from the transform over a short interval about t.
+            static constexpr float dt = 20e-6; //sec. Real times are in whole ns, so this gives a relative error of about 1e-4.
+            float t0 = std::max(0.f, t-dt), t1 = std::min(duration, t+dt);
+            StepTimeT real0 = accel.transform(drv::AxisStepper::timeFromSeconds(t0));
+            StepTimeT real1 = accel.transform(drv::AxisStepper::timeFromSeconds(t1));
+            return real1 > real0 ? (t1-t0)/drv::AxisStepper::secondsFromTime(real1-real0) : 1;
+        }
+        void _initAxisArcSteppers(StepperSet &set, const drv::ArcPath &arc, std::true_type) {
+            drv::AxisStepper::initAxisArcSteppers(set.iters, set.startPos, arc);
+        }
+        void _initAxisArcSteppers(StepperSet &, const drv::ArcPath &, std::false_type) {
+            //unreachable, as arcs are never queued unless supportsArcs()
+        }
+        static constexpr float TWO_PI() { return 6.283185307179586f; }
+        float _junctionVel(const MotionSegment &prev, const MotionSegment &next, float junctionDeviation) const {
+            //Find the maximum velocity at which the joint between prev and next can be taken.
+            //The joint is approximated by an arc which deviates no more than junctionDeviation from the corner, and the velocity is limited such that the centripetal acceleration around that arc doesn't exceed maxAccel.
+            //See https://onehossshop.com/grbl-junction-deviation/ or Grbl's planner.c for details.
+            if (!(prev.dist > 0) || !(next.dist > 0)) {
+                return 0; //extrusion-only moves always begin and end at rest.
+            }
+            float maxVel = std::min(prev.nominalVel, next.nominalVel);
+            float cosTheta = -(prev.exitUx*next.ux + prev.exitUy*next.uy + prev.exitUz*next.uz); //theta is the angle between the two paths (180 deg = straight line)
+            if (cosTheta < -0.999f) { //straight line; no need to slow down
+                return maxVel;
+            } else if (cosTheta > 0.999f) { //full reversal
+                return 0;
+            }
+            float sinHalfTheta = std::sqrt(0.5f*(1-cosTheta));
+            float accel = std::min(_cur->accel.maxAccel(), std::min(prev.accelLimit, next.accelLimit));
+            float junctionVel = std::sqrt(accel*junctionDeviation*sinHalfTheta/(1-sinHalfTheta));
+            return std::min(maxVel, junctionVel);
+        }
+        float _maxReachableVel(float vel, const MotionSegment &seg) const {
+            //the velocity that can be reached by accelerating (or decelerating) from vel over the length of seg.
+            //This depends upon the shape of the acceleration profile (eg a jerk-limited profile needs more distance than a constant-acceleration one).
+            return _cur->accel.maxReachableVel(vel, seg.dist, seg.accelLimit);
+        }
+        void _replan() {
+            //recompute the entry velocity of each segment that hasn't yet begun stepping.
+            std::size_t first = _motionType == MotionLinear && (_isSampling || !isShaped()) ? 1 : 0; //the segment being stepped cannot be changed.
+            if (_segments.size() <= first) {
+                return;
+            }
+            //backward pass: ensure we can always come to a stop by the end of the last queued segment.
+            float nextEntryVel = 0;
+            for (std::size_t i=_segments.size()-1; i>first; --i) {
+                MotionSegment &seg = _segments[i];
+                seg.entryVel = std::min(seg.maxEntryVel, _maxReachableVel(nextEntryVel, seg));
+                nextEntryVel = seg.entryVel;
+            }
+            //the first unstarted segment must begin at whatever velocity the current segment was planned to exit at.
+            _segments[first].entryVel = first ? _cur->exitVel : 0;
+            //forward pass: don't ask for an entry velocity that the previous segment can't accelerate to.
+            for (std::size_t i=first; i+1<_segments.size(); ++i) {
+                MotionSegment &next = _segments[i+1];
+                next.entryVel = std::min(next.entryVel, _maxReachableVel(_segments[i].entryVel, _segments[i]));
+            }
+        }
     public:
         bool isHoming() const {
             return _motionType == MotionHome;
         }
+        void sampleEndstops() {
+            //called by State as often as it can while homing, so that an endstop is noticed as soon as it triggers, rather than only when the next step of its axis is computed.
+            if (isHoming()) {
+                drv::AxisStepper::sampleEndstops(_homeIters);
+            }
+        }
         Event nextStep() {
             //called by State to query the next step in the current path segment
             if (_motionType == MotionNone) {
-                return Event(); //no next step; return a null Event
+                if (_segments.empty()) {
+                    return Event(); //no next step; return a null Event
+                }
+                if (isShaped()) {
+                    _restartShaping();
+                } else {
+                    _beginSegment();
+                }
             }
             if ((isHoming() && std::tuple_size<HomeStepperTypes>::value == 0) || (!isHoming() && std::tuple_size<AxisStepperTypes>::value == 0)) {
                 return Event(); //sanity checks. Should get optimized away on most machines.
             }
             if (isHoming()) {
                 return _nextStepHoming(std::integral_constant<bool, std::tuple_size<HomeStepperTypes>::value != 0>());
+            } else if (isShaped()) {
+                return _nextShapedStep(std::integral_constant<bool, std::tuple_size<AxisStepperTypes>::value != 0>());
             } else {
                 return _nextStepMoving(std::integral_constant<bool, std::tuple_size<AxisStepperTypes>::value != 0>());
             }
         }
-        void moveTo(EventClockT::time_point baseTime, float x, float y, float z, float e, float maxVelXyz, float minVelE, float maxVelE) {
-            //called by State to queue a movement from the current destination to a new one, with the desired motion beginning at baseTime
+        std::size_t nextSteps(Event *out, std::size_t maxEvents) {
+            //fill out[0:maxEvents] with as many of the upcoming steps as are available, and return the number of Events written.
+            //This amortizes the per-call overhead of the State's idle loop at high step rates.
+            //While homing, at most one step is returned, as each step depends upon the state of the endstops at the time it's executed.
+            std::size_t numEvents = 0;
+            while (numEvents < maxEvents) {
+                Event e = nextStep();
+                if (e.isNull()) {
+                    break;
+                }
+                out[numEvents++] = e;
+                if (isHoming()) {
+                    break;
+                }
+            }
+            return numEvents;
+        }
+        bool prepareNextSegment() {
+            //called by State when it has nothing better to do: initialize the steppers for the segment after the current one ahead of time,
+            //  so that none of that work is left for the joint between them. Returns true if anything was done.
+            //The mechanical position at which the current segment will end can only be predicted, but the prediction is checked before the prepared steppers are used.
+            if (isShaped() || _motionType != MotionLinear || _isNextPrepared || _isEndUnpredictable || _segments.size() < 2 || !_canPredictEnd) {
+                return false;
+            }
+            std::array<int, CoordMapT::numAxis()> endPos = _destMechanicalPos;
+            if (!_predictEndPosition(endPos)) {
+                _isEndUnpredictable = true;
+                return false;
+            }
+            const MotionSegment &seg = _segments[1];
+            _prepareSteppers(*_next, seg, endPos, _cur->destX, _cur->destY, _cur->destZ, _cur->destE);
+            _prepareProfile(*_next, seg, _segments.size() > 2 ? _segments[2].entryVel : 0);
+            _isNextPrepared = true;
+            return true;
+        }
+        static constexpr bool supportsArcs() {
+            //true if moveArc() may be used; otherwise arcs must be broken into linear moves by the caller.
+            return drv::AxisStepper::SupportsArcs<AxisStepperTypes>::value;
+        }
+        bool moveTo(EventClockT::time_point baseTime, float x, float y, float z, float e, float maxVelXyz, float minVelE, float maxVelE, float junctionDeviation, float pressureAdvance) {
+            //called by State to queue a movement from the current destination to a new one, with the desired motion beginning no earlier than baseTime
+            //Returns false if the move had to be broken into more segments than there was room for (see drivers/bedmesh.h).
+            //  In that case, call it again with the same arguments once readyForNextMove(); it will continue from where it left off.
             //Note: it is illegal to call this if readyForNextMove() != true
             if (std::tuple_size<AxisStepperTypes>::value == 0) {
-                return; //Sanity check. Algorithms only work for machines with atleast 1 axis.
+                return true; //Sanity check. Algorithms only work for machines with atleast 1 axis.
             }
-            this->_baseTime = baseTime.time_since_epoch();
             float curX, curY, curZ, curE;
-            std::tie(curX, curY, curZ, curE) = CoordMapT::xyzeFromMechanical(_destMechanicalPos);
+            _queuedDestination(curX, curY, curZ, curE);
             std::tie(x, y, z) = CoordMapT::applyLeveling(std::make_tuple(x, y, z)); //get the REAL destination.
             std::tie(x, y, z, e) = CoordMapT::bound(std::make_tuple(x, y, z, e)); //Fix impossible coordinates
             
-            //Calculate velocities in x, y, z, e directions, and the duration of the linear movement:
-            float distSq = (x-curX)*(x-curX) + (y-curY)*(y-curY) + (z-curZ)*(z-curZ);
-            float dist = sqrt(distSq);
+            LOGD("MotionPlanner::moveTo (%f, %f, %f, %f) -> (%f, %f, %f, %f)\n", curX, curY, curZ, curE, x, y, z, e);
+            //The bed mesh offset varies along the move, so it may need to be made as several straight segments.
+            //  They are placed along the line the move would follow without the mesh, which begins at the queued destination less its offset.
+            float lineZ = curZ - CoordMapT::meshOffset(curX, curY);
+            while (true) {
+                float frac = CoordMapT::meshSplitFraction(curX, curY, x, y);
+                MotionSegment seg;
+                if (frac < 1) {
+                    std::tie(seg.x, seg.y, seg.e) = std::make_tuple(curX + frac*(x-curX), curY + frac*(y-curY), curE + frac*(e-curE));
+                    lineZ += frac*(z-lineZ);
+                } else {
+                    std::tie(seg.x, seg.y, seg.e) = std::make_tuple(x, y, e);
+                    lineZ = z;
+                }
+                seg.z = lineZ + CoordMapT::meshOffset(seg.x, seg.y);
+                _setLinear(seg, curX, curY, curZ);
+                _queueSegment(seg, curX, curY, curZ, curE, baseTime, maxVelXyz, minVelE, maxVelE, junctionDeviation, pressureAdvance);
+                if (frac >= 1) {
+                    return true;
+                } else if (_segments.full()) {
+                    return false;
+                }
+                std::tie(curX, curY, curZ, curE) = std::make_tuple(seg.x, seg.y, seg.z, seg.e);
+            }
+        }
+        void moveArc(EventClockT::time_point baseTime, float x, float y, float z, float e, float centerX, float centerY, bool isClockwise, float maxVelXyz, float minVelE, float maxVelE, float junctionDeviation, float pressureAdvance) {
+            //called by State to queue an arc about (centerX, centerY) in the XY plane from the current destination to a new one (it becomes a helix if z changes).
+            //If the destination is the current position, then a full circle is made.
+            //Note: it is illegal to call this if readyForNextMove() != true or supportsArcs() != true
+            if (std::tuple_size<AxisStepperTypes>::value == 0) {
+                return; //Sanity check. Algorithms only work for machines with atleast 1 axis.
+            }
+            float curX, curY, curZ, curE;
+            _queuedDestination(curX, curY, curZ, curE);
+            std::tie(centerX, centerY, std::ignore) = CoordMapT::applyLeveling(std::make_tuple(centerX, centerY, z));
+            std::tie(x, y, z) = CoordMapT::applyLeveling(std::make_tuple(x, y, z));
+            std::tie(x, y, z, e) = CoordMapT::bound(std::make_tuple(x, y, z, e));
+            z += CoordMapT::meshOffset(x, y); //arcs aren't divided to follow the bed mesh; only their endpoints are corrected.
+
+            LOGD("MotionPlanner::moveArc (%f, %f, %f, %f) -> (%f, %f, %f, %f) about (%f, %f)\n", curX, curY, curZ, curE, x, y, z, e, centerX, centerY);
+            MotionSegment seg;
+            std::tie(seg.x, seg.y, seg.z, seg.e) = std::make_tuple(x, y, z, e);
+            float radius = std::hypot(curX-centerX, curY-centerY);
+            if (!(radius > 0)) {
+                _setLinear(seg, curX, curY, curZ); //degenerate arc
+            } else {
+                seg.isArc = true;
+                seg.centerX = centerX;
+                seg.centerY = centerY;
+                seg.startAngle = std::atan2(curY-centerY, curX-centerX);
+                seg.arcAngle = std::atan2(y-centerY, x-centerX) - seg.startAngle;
+                if (isClockwise && seg.arcAngle >= 0) {
+                    seg.arcAngle -= TWO_PI();
+                } else if (!isClockwise && seg.arcAngle <= 0) {
+                    seg.arcAngle += TWO_PI();
+                }
+                seg.dist = std::hypot(radius*seg.arcAngle, z-curZ);
+                //the tangent at angle a is (-sin(a), cos(a)) per radian swept:
+                float endAngle = seg.startAngle + seg.arcAngle;
+                //The arc keeps the radius it begins with, so it only reaches the destination if that's the same distance from the center.
+                //  G-code rarely matches exactly, so the move ends wherever the arc actually does, and the next one begins from there.
+                seg.x = centerX + radius*std::cos(endAngle);
+                seg.y = centerY + radius*std::sin(endAngle);
+                seg.ux = -radius*seg.arcAngle*std::sin(seg.startAngle)/seg.dist;
+                seg.uy = radius*seg.arcAngle*std::cos(seg.startAngle)/seg.dist;
+                seg.exitUx = -radius*seg.arcAngle*std::sin(endAngle)/seg.dist;
+                seg.exitUy = radius*seg.arcAngle*std::cos(endAngle)/seg.dist;
+                seg.uz = seg.exitUz = (z-curZ)/seg.dist;
+            }
+            _queueSegment(seg, curX, curY, curZ, curE, baseTime, maxVelXyz, minVelE, maxVelE, junctionDeviation, pressureAdvance);
+        }
+    private:
+        void _queuedDestination(float &x, float &y, float &z, float &e) const {
+            //the next move begins wherever the last queued move ends:
+            if (_segments.empty()) {
+                std::tie(x, y, z, e) = std::make_tuple(_destX, _destY, _destZ, _destE);
+            } else {
+                const MotionSegment &prev = _segments.back();
+                std::tie(x, y, z, e) = std::make_tuple(prev.x, prev.y, prev.z, prev.e);
+            }
+        }
+        static void _setLinear(MotionSegment &seg, float curX, float curY, float curZ) {
+            //make seg a straight line from (curX, curY, curZ) to its destination.
+            float distSq = (seg.x-curX)*(seg.x-curX) + (seg.y-curY)*(seg.y-curY) + (seg.z-curZ)*(seg.z-curZ);
+            seg.dist = sqrt(distSq);
+            seg.isArc = false;
+            seg.ux = seg.exitUx = seg.dist > 0 ? (seg.x-curX)/seg.dist : 0;
+            seg.uy = seg.exitUy = seg.dist > 0 ? (seg.y-curY)/seg.dist : 0;
+            seg.uz = seg.exitUz = seg.dist > 0 ? (seg.z-curZ)/seg.dist : 0;
+        }
+        std::array<float, CoordMapT::numAxis()> _axisVelocityAt(const MotionSegment &seg, float curX, float curY, float curZ, float curE, float radius, float dist) const {
+            //the velocity of each mechanical axis per mm/sec of effector velocity (or of extrusion, for extrusion-only moves), once the effector has travelled dist mm along the path
+            float frac = seg.dist > 0 ? dist/seg.dist : 0;
+            float x, y, z, ux, uy, uz, ue;
+            z = curZ + frac*(seg.z-curZ);
+            if (seg.isArc) {
+                float angle = seg.startAngle + frac*seg.arcAngle;
+                x = seg.centerX + radius*std::cos(angle);
+                y = seg.centerY + radius*std::sin(angle);
+                ux = -radius*seg.arcAngle*std::sin(angle)/seg.dist;
+                uy = radius*seg.arcAngle*std::cos(angle)/seg.dist;
+            } else {
+                x = curX + frac*(seg.x-curX);
+                y = curY + frac*(seg.y-curY);
+                ux = seg.ux;
+                uy = seg.uy;
+            }
+            uz = seg.uz;
+            ue = seg.dist > 0 ? (seg.e-curE)/seg.dist : 1;
+            return CoordMapT::mechanicalVelocity(std::make_tuple(x, y, z), std::make_tuple(ux, uy, uz, ue));
+        }
+        void _limitByAxes(MotionSegment &seg, float curX, float curY, float curZ, float curE, float &maxVelXyz, float &minVelE, float &maxVelE) {
+            //Find the greatest velocity & acceleration with which no mechanical axis exceeds its limits, by sampling the mapping to mechanical coordinates along the path.
+            //At path velocity v & acceleration a, each axis moves at J*v and accelerates at J*a + K*v^2, where J is its velocity per mm/sec of effector velocity
+            //  and K = dJ/ds is the curvature of the path as seen by that axis (eg a delta carriage, near the edge of the plate).
+            //The velocity is capped so that K*v^2 uses no more than MOTION_PLANNER_AXIS_CURVATURE_SHARE of any axis' acceleration limit, and a gets the remainder.
+            std::array<float, CoordMapT::numAxis()> ratios, curvatures;
+            ratios.fill(0);
+            curvatures.fill(0);
+            float radius = seg.isArc ? std::hypot(curX-seg.centerX, curY-seg.centerY) : 0;
+            //J is found at 3 points spaced h apart around each sample (shifted to stay on the path at either end), and K from the quadratic through them.
+            float h = std::min((float)MOTION_PLANNER_AXIS_CURVATURE_DIST, seg.dist/2);
+            for (int i=0; i<MOTION_PLANNER_AXIS_LIMIT_SAMPLES; ++i) {
+                float dist = seg.dist*i/(MOTION_PLANNER_AXIS_LIMIT_SAMPLES-1);
+                if (h <= 0) {
+                    std::array<float, CoordMapT::numAxis()> vel = _axisVelocityAt(seg, curX, curY, curZ, curE, radius, dist);
+                    for (std::size_t axis=0; axis<ratios.size(); ++axis) {
+                        ratios[axis] = std::max(ratios[axis], std::fabs(vel[axis]));
+                    }
+                    continue;
+                }
+                float start = std::max(0.f, std::min(seg.dist - 2*h, dist - h));
+                float t = (dist - start)/h; //position of the sample, in units of h past the first point
+                std::array<std::array<float, CoordMapT::numAxis()>, 3> vel;
+                for (int j=0; j<3; ++j) {
+                    vel[j] = _axisVelocityAt(seg, curX, curY, curZ, curE, radius, start + j*h);
+                }
+                for (std::size_t axis=0; axis<ratios.size(); ++axis) {
+                    float slope = vel[1][axis] - vel[0][axis], bend = vel[2][axis] - 2*vel[1][axis] + vel[0][axis];
+                    ratios[axis] = std::max(ratios[axis], std::fabs(vel[0][axis] + slope*t + bend*t*(t-1)/2));
+                    curvatures[axis] = std::max(curvatures[axis], std::fabs(slope + bend*(2*t-1)/2)/h);
+                }
+            }
+            float velLimit = INFINITY;
+            for (std::size_t axis=0; axis<ratios.size(); ++axis) {
+                if (ratios[axis] > 0) {
+                    velLimit = std::min(velLimit, _maxAxisVel[axis]/ratios[axis]);
+                }
+                if (curvatures[axis] > 0) {
+                    velLimit = std::min(velLimit, std::sqrt((float)MOTION_PLANNER_AXIS_CURVATURE_SHARE*_maxAxisAccel[axis]/curvatures[axis]));
+                }
+            }
+            //the move never goes faster than this, so the acceleration left over by the curvature at this velocity can always be used:
+            float topVel = seg.dist > 0 ? std::min(maxVelXyz, velLimit) : 0;
+            seg.accelLimit = INFINITY;
+            for (std::size_t axis=0; axis<ratios.size(); ++axis) {
+                if (ratios[axis] > 0) {
+                    seg.accelLimit = std::min(seg.accelLimit, (_maxAxisAccel[axis] - curvatures[axis]*topVel*topVel)/ratios[axis]);
+                }
+            }
+            if (seg.dist > 0) {
+                maxVelXyz = std::min(maxVelXyz, velLimit);
+            } else {
+                minVelE = std::max(minVelE, -velLimit);
+                maxVelE = std::min(maxVelE, velLimit);
+            }
+        }
+        void _queueSegment(MotionSegment &seg, float curX, float curY, float curZ, float curE, EventClockT::time_point baseTime, float maxVelXyz, float minVelE, float maxVelE, float junctionDeviation, float pressureAdvance) {
+            //Calculate the velocity & duration of the move, and queue it for planning.
+            float dist = seg.dist;
+            if (dist == 0 && seg.e == curE) {
+                return; //nothing to do.
+            }
+            _limitByAxes(seg, curX, curY, curZ, curE, maxVelXyz, minVelE, maxVelE);
+            if (seg.isArc) {
+                //limit the centripetal acceleration, v^2/radius:
+                float accel = std::min(_cur->accel.maxAccel(), seg.accelLimit);
+                if (accel > 0) {
+                    maxVelXyz = std::min(maxVelXyz, std::sqrt(accel*std::hypot(curX-seg.centerX, curY-seg.centerY)));
+                }
+            }
             float minDuration = dist/maxVelXyz; //duration, should there be no acceleration
-            float velE = (e-curE)/minDuration;
+            float velE = (seg.e-curE)/minDuration;
             //float newVelE = this->driver.clampExtrusionRate(velE);
             float newVelE = std::max(minVelE, std::min(maxVelE, velE));
             if (velE != newVelE) { //in the case that newXYZ = currentXYZ, but extrusion is different, regulate that.
                 velE = newVelE;
-                minDuration = (e-curE)/newVelE; //L/(L/t) = t
+                minDuration = (seg.e-curE)/newVelE; //L/(L/t) = t
                 maxVelXyz = dist/minDuration;
             }
-            
-            float vx = (x-curX)/minDuration;
-            float vy = (y-curY)/minDuration;
-            float vz = (z-curZ)/minDuration;
-            LOGD("MotionPlanner::moveTo (%f, %f, %f, %f) -> (%f, %f, %f, %f)\n", curX, curY, curZ, curE, x, y, z, e);
-            LOGD("MotionPlanner::moveTo _destMechanicalPos: (%i, %i, %i, %i)\n", _destMechanicalPos[0], _destMechanicalPos[1], _destMechanicalPos[2], _destMechanicalPos[3]);
-            //LOGD("MotionPlanner::moveTo V:%f, vx:%f, vy:%f, vz:%f, ve:%f dur:%f\n", maxVelXyz, vx, vy, vz, velE, minDuration);
-            drv::AxisStepper::initAxisSteppers(_iters, _destMechanicalPos, vx, vy, vz, velE);
-            this->_duration = minDuration;
-            this->_motionType = MotionLinear;
-            this->_accel.begin(minDuration, maxVelXyz);
+            //LOGD("MotionPlanner::moveTo V:%f, ve:%f dur:%f\n", maxVelXyz, velE, minDuration);
+            seg.duration = minDuration;
+            seg.nominalVel = maxVelXyz;
+            seg.velE = velE;
+            seg.pressureAdvance = pressureAdvance;
+            //A move queued behind one that's already being stepped may still blend with it (if the running segment plans to exit in motion)
+            seg.maxEntryVel = _segments.empty() ? 0 : _junctionVel(_segments.back(), seg, junctionDeviation);
+            seg.entryVel = 0;
+            seg.baseTime = baseTime.time_since_epoch();
+            _segments.push_back(seg);
+            _replan();
         }
-
-        void homeEndstops(EventClockT::time_point baseTime, float maxVelXyz) {
+    public:
+        void homeEndstops(EventClockT::time_point baseTime, float maxVelXyz, float backOffDist=0) {
             //Called by State to begin a motion that homes to the endstops (and stays there)
-            //Note: it is illegal to call this if readyForNextMove() != true
+            //If backOffDist is nonzero, the axes instead move that far (in mm) away from the endstops they're resting on, so that they can be homed again more slowly.
+            //Note: it is illegal to call this if readyForNextHome() != true
             if (std::tuple_size<HomeStepperTypes>::value == 0) {
                 return; //Sanity check. Algorithms only work for machines with atleast 1 axis.
             }
-            drv::AxisStepper::initAxisHomeSteppers(_homeIters, maxVelXyz);
-            this->_baseTime = baseTime.time_since_epoch();
-            this->_duration = NAN;
+            _isBackingOff = backOffDist > 0;
+            drv::AxisStepper::initAxisHomeSteppers(_homeIters, maxVelXyz, backOffDist);
+            this->_baseTime = std::max(baseTime.time_since_epoch(), _endTime); //don't begin homing before the last move's final steps
+            _cur->duration = drv::AxisStepper::noStep(); //homing continues until the endstops are hit
             this->_motionType = MotionHome;
-            this->_accel.begin(NAN, maxVelXyz);
+            _cur->accel.begin(NAN, maxVelXyz);
         }
 };
 
@@ -0,0 +1,237 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Colin Wallace
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Printipi/motion/scurveacceleration.h
+ *
+ * SCurveAcceleration is an implementation of motion/AccelerationProfile that limits jerk (the rate of change of acceleration) as well as acceleration.
+ * Each move has up to 7 phases:
+ *   1. jerk +J until the acceleration reaches ap (<= A, or the move's accelLimit if that's lower)
+ *   2. constant acceleration ap
+ *   3. jerk -J until the acceleration is 0 (the peak velocity, vp, is reached)
+ *   4. constant velocity vp
+ *   5-7. the mirror of 1-3, decelerating to the exit velocity.
+ * Phases 2 & 6 are absent if the velocity change is too small to reach A, and phase 4 is absent if the move is too short to reach Vmax.
+ * Because the acceleration is always 0 at the start and end of a move, consecutive (blended) moves join without a jump in acceleration.
+ *
+ * The transform is closed-form: phases 2, 4 and 6 are (at most) quadratic in time, and the jerk phases are cubics which always have either
+ *   exactly one real root or a known ordering of roots, so Cardano's formula (or its trigonometric form) can be applied directly without iteration.
+ * The only iterative step is the search for vp in begin(), which happens once per move.
+ *
+ * As raising A without limiting jerk tends to excite ringing in the frame, a machine using this profile can usually use a larger MAX_ACCEL1000 than it could with ConstantAcceleration.
+ */
+
+#ifndef MOTION_SCURVEACCELERATION_H
+#define MOTION_SCURVEACCELERATION_H
+
+#include "accelerationprofile.h"
+#include "common/logging.h"
+#include <cmath> //for sqrt, cbrt, acos, cos, isnan
+#include <algorithm> //for min, max
+
+template <int Accel1000, int Jerk1000> class SCurveAcceleration : public AccelerationProfile {
+    static constexpr double A() { return Accel1000 / 1000.; } //mm/sec^2
+    static constexpr double J() { return Jerk1000 / 1000.; } //mm/sec^3
+    //One phase of the motion. Within a phase, the jerk is constant.
+    struct Phase {
+        double t0, s0, v0; //real time, distance and velocity at the start of the phase
+        double t1, s1, v1; //real time, distance and velocity at the end of the phase
+        double a0, jerk; //acceleration at the start of the phase & (constant) jerk throughout it
+    };
+    Phase phases[7];
+    double Vmax;
+    double accel; //the acceleration limit for the current move: A(), or lower if the MotionPlanner asked for it
+    public:
+        inline float maxAccel() const {
+            return A();
+        }
+        //The MotionPlanner must not ask for a velocity change that can't be made within the length of a move.
+        //The jerk-limited ramps are longer than constant-acceleration ones, so the default (constant acceleration) relation can't be used.
+        float maxReachableVel(float vel, float dist, float accelLimit=INFINITY) const {
+            if (!(dist > 0)) {
+                return vel;
+            }
+            return vel + _rampDv(std::min(A(), (double)accelLimit), vel, dist);
+        }
+        void begin(float moveDuration, float Vmax, float Vstart=0, float Vend=0, float accelLimit=INFINITY) {
+            this->Vmax = Vmax;
+            this->accel = std::min(A(), (double)accelLimit);
+            if (!(Vmax > 0)) { //no cartesian movement (eg extrusion-only), so there's nothing to accelerate.
+                return; //transform() is the identity function in this case.
+            }
+            double v0 = Vstart, v1 = Vend;
+            double vp;
+            double dist = (double)Vmax*moveDuration;
+            if (std::isnan(moveDuration)) { //homing: accelerate to Vmax and cruise indefinitely.
+                vp = Vmax;
+                v1 = Vmax;
+            } else if (_rampDist(accel, v0, Vmax) + _rampDist(accel, Vmax, v1) <= dist) { //enough room to reach Vmax
+                vp = Vmax;
+            } else {
+                //the distance needed by both ramps grows monotonically with vp, so the largest vp that fits is found by bisection.
+                //The MotionPlanner guarantees that a single ramp from v0 to v1 fits (to within rounding errors).
+                double lo = std::max(v0, v1), hi = Vmax;
+                for (int i=0; i<32; ++i) {
+                    double mid = 0.5*(lo+hi);
+                    if (_rampDist(accel, v0, mid) + _rampDist(accel, mid, v1) <= dist) {
+                        lo = mid;
+                    } else {
+                        hi = mid;
+                    }
+                }
+                vp = lo;
+            }
+            double cruiseDist = std::isnan(moveDuration) ? INFINITY : std::max(0., dist - _rampDist(accel, v0, vp) - _rampDist(accel, vp, v1));
+            _setPhases(v0, vp, v1, cruiseDist);
+            LOGD("SCurveAccel::begin dur, Vmax, Vstart, Vend: %f, %f, %f, %f\n", moveDuration, Vmax, Vstart, Vend);
+            LOGD("SCurveAccel::begin vp, cruise: %f, %f; end time %f\n", vp, cruiseDist, phases[6].t1);
+        }
+        StepTimeT transform(StepTimeT stepTime) {
+            double time = stepTime.count()*1e-9; //seconds
+            if (!(Vmax > 0)) {
+                return stepTime;
+            }
+            double s = Vmax*time; //distance (mm) travelled by the constant-velocity event
+            //find the phase containing s. Zero-length phases are skipped, as s >= their end.
+            int k = 0;
+            while (k < 6 && s >= phases[k].s1) {
+                ++k;
+            }
+            const Phase &p = phases[k];
+            double real;
+            if (p.jerk == 0) { //constant acceleration (possibly zero): s - s0 = v0*t + a0/2*t^2
+                real = p.t0 + _solveQuadratic(p.v0, p.a0, s - p.s0);
+            } else if (p.a0 == 0) { //jerk begins at zero acceleration (phases 1 & 5): s - s0 = v0*t + jerk/6*t^3
+                real = p.t0 + _solveCubic(p.v0, p.jerk, s - p.s0);
+            } else { //jerk ends at zero acceleration (phases 3 & 7). Measured backward from the end of the phase: s1 - s = v1*t + jerk/6*t^3
+                real = p.t1 - _solveCubic(p.v1, p.jerk, p.s1 - s);
+            }
+            LOGV("SCurveAccel::transform: %f -> %f (phase %i)\n", time, real, k+1);
+            return StepTimeT((StepTimeT::rep)(real*1e9 + 0.5));
+        }
+    private:
+        //Velocity ramps:
+        //A ramp from va to vb (either direction) with acceleration limit a takes jerkTime = min(a/J, sqrt(|dv|/J)) to build up to its peak acceleration, ap = J*jerkTime, and the same time to return to 0.
+        //Between those, it holds ap for |dv|/ap - jerkTime. The ramp's velocity is symmetric about its midpoint, so the distance covered is (va+vb)/2 * duration.
+        static double _jerkTime(double a, double dv) {
+            return std::min(a/J(), std::sqrt(std::fabs(dv)/J()));
+        }
+        static double _rampDuration(double a, double dv) {
+            if (dv == 0) {
+                return 0;
+            }
+            double jerkTime = _jerkTime(a, dv);
+            return std::fabs(dv)/(J()*jerkTime) + jerkTime;
+        }
+        static double _rampDist(double a, double va, double vb) {
+            return 0.5*(va+vb)*_rampDuration(a, vb-va);
+        }
+        //the largest velocity increase which can be achieved from vel within the given distance. This is the inverse of _rampDist.
+        static double _rampDv(double a, double vel, double dist) {
+            double dvFullAccel = a*a/J(); //the smallest velocity change for which the ramp reaches a
+            if (dist >= _rampDist(a, vel, vel+dvFullAccel)) {
+                //duration = dv/a + a/J, so dist = (2*vel + dv)/2*(dv/a + a/J), a quadratic in dv: dv^2 + b*dv + c = 0
+                double b = 2*vel + dvFullAccel;
+                double c = 2*vel*dvFullAccel - 2*a*dist; //<= 0
+                return -2*c / (b + std::sqrt(b*b - 4*c));
+            } else {
+                //duration = 2*sqrt(dv/J), so dist = (2*vel + dv)*sqrt(dv/J). With u = sqrt(dv), u^3 + 2*vel*u - dist*sqrt(J) = 0
+                double u = _cubicRoot(2*vel, -dist*std::sqrt(J()));
+                return u*u;
+            }
+        }
+        //Find the real root of x^3 + p*x + q = 0, for p >= 0 (in which case there is exactly one).
+        static double _cubicRoot(double p, double q) {
+            if (q == 0) {
+                return 0;
+            }
+            //Cardano: x = w - p/(3w), where w^3 = -q/2 + sqrt(q^2/4 + p^3/27).
+            //Written as x = -q/(w^2 + p/3 + (p/3)^2/w^2) (via w^3 + (-p/(3w))^3 = -q), which avoids the cancellation in w - p/(3w) when x is small.
+            double p3 = p/3;
+            double w = std::cbrt(-0.5*q + std::copysign(std::sqrt(0.25*q*q + p3*p3*p3), -q));
+            double w2 = w*w;
+            return -q / (w2 + p3 + p3*p3/w2);
+        }
+        //solve v*t + jerk/6*t^3 = dist for the smallest t >= 0, given v >= 0 and dist >= 0.
+        static double _solveCubic(double v, double jerk, double dist) {
+            if (!(dist > 0)) {
+                return 0;
+            }
+            //t^3 + p*t + q = 0:
+            double p = 6*std::max(0., v)/jerk;
+            double q = -6*dist/jerk;
+            if (p >= 0) {
+                return _cubicRoot(p, q);
+            } else {
+                //jerk < 0: there are 3 real roots (while the velocity is still positive), of which we want the smaller positive one.
+                //trigonometric form: t = 2*m*cos(theta/3 - 2*pi/3), m = sqrt(-p/3), cos(theta) = 3q/(2p)*sqrt(-3/p)
+                double m = std::sqrt(-p/3);
+                double cosTheta = std::max(-1., std::min(1., 1.5*q/(p*m)));
+                return 2*m*std::cos((std::acos(cosTheta) - 2*3.14159265358979323846)/3);
+            }
+        }
+        //solve v*t + a/2*t^2 = dist for the smallest t >= 0
+        static double _solveQuadratic(double v, double a, double dist) {
+            if (!(dist > 0)) {
+                return 0;
+            }
+            //t = (sqrt(v^2 + 2*a*dist) - v)/a, rewritten to avoid cancellation when a is small
+            return 2*dist/(v + std::sqrt(std::max(0., v*v + 2*a*dist)));
+        }
+        //Fill out the 7 phases for the motion v0 -> vp -> (cruise for cruiseDist) -> v1
+        void _setPhases(double v0, double vp, double v1, double cruiseDist) {
+            double t = 0, s = 0, v = v0;
+            int k = 0;
+            //append a phase of constant jerk lasting dt that begins with acceleration a0.
+            auto append = [&](double dt, double a0, double jerk) {
+                Phase &p = phases[k++];
+                p.t0 = t; p.s0 = s; p.v0 = v;
+                p.a0 = a0; p.jerk = jerk;
+                if (std::isinf(dt)) { //cruising indefinitely (homing)
+                    p.t1 = p.s1 = p.v1 = INFINITY;
+                    return;
+                }
+                t += dt;
+                s += v*dt + a0/2*dt*dt + jerk/6*dt*dt*dt;
+                v += a0*dt + jerk/2*dt*dt;
+                p.t1 = t; p.s1 = s; p.v1 = v;
+            };
+            //append the 3 phases needed to ramp from the current velocity to vb
+            auto ramp = [&](double vb) {
+                double dv = vb - v;
+                double jerkTime = _jerkTime(accel, dv);
+                double jerk = dv > 0 ? J() : -J();
+                double ap = jerk*jerkTime;
+                double accelTime = dv == 0 ? 0 : dv/ap - jerkTime;
+                append(jerkTime, 0, jerk);
+                append(accelTime, ap, 0);
+                append(jerkTime, ap, -jerk);
+                v = phases[k-1].v1 = vb; //remove accumulated rounding error (which could otherwise leave a slightly negative exit velocity)
+            };
+            ramp(vp);
+            append(cruiseDist/vp, 0, 0);
+            ramp(v1);
+        }
+};
+
+#endif
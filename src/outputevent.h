@@ -39,6 +39,7 @@ class OutputEvent {
     GpioPinIdType _pinId;
     bool _state; //1=HIGH, 0=LOW
     public:
+        OutputEvent() : _time(), _pinId(0), _state(false) {} //allows OutputEvents to be stored in fixed-size arrays (eg the Scheduler's _eventQueue & the batches it hands to the interface)
         OutputEvent(EventClockT::time_point time, GpioPinIdType pinId, bool state) : _time(time), _pinId(pinId), _state(state) {
         }
         inline EventClockT::time_point time() const {
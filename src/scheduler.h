@@ -27,8 +27,10 @@
  * The Scheduler controls program flow between tending communications and executing events at precise times.
  * It also allows for software PWM of any output.
  * It is designed to run in a single-threaded environment so it can have maximum control.
- * As such, the program should call Scheduler.yield() periodically if doing any long-running task.
  * Events can be queued with Scheduler.queue, and Scheduler.eventLoop should be called after any program setup is completed.
+ * Queued events are held in a preallocated queue and handed to the HardwareScheduler as soon as they fall within its scheduling window (see HardwareScheduler::schedTime).
+ *   This lets a buffered HardwareScheduler (eg the DMA one) be kept full, while Scheduler.queue only blocks when the queue itself is full.
+ * The look-ahead horizon limits how far into the future events will be accepted (via isRoomInBuffer), which bounds how far motion may be planned ahead of real time.
  */
 #ifndef SCHEDULER_H
 #define SCHEDULER_H
@@ -36,10 +38,13 @@
 
 #include <cassert> //for assert
 #include <array>
+#include <algorithm> //for std::max, std::min
 #include "event.h"
 #include "outputevent.h"
+#include "stepdiroutputs.h"
 #include "common/logging.h"
 #include "common/intervaltimer.h"
+#include "common/ringbuffer.h"
 #include "common/typesettings/compileflags.h"
 #include "drivers/auto/thisthreadsleep.h" //for SleepT
 
@@ -48,6 +53,16 @@
 #endif
 #include "schedulerbase.h"
 
+#ifndef SCHEDULER_QUEUE_LEN
+    #define SCHEDULER_QUEUE_LEN 1024 //number of OutputEvents that can be waiting to enter the HardwareScheduler's scheduling window
+#endif
+#ifndef SCHEDULER_BATCH_LEN
+    #define SCHEDULER_BATCH_LEN 64 //max number of OutputEvents handed to the interface in one call to queueBatch
+#endif
+#ifndef SCHEDULER_LOOKAHEAD_US
+    #define SCHEDULER_LOOKAHEAD_US 100000 //default look-ahead horizon: isRoomInBuffer() is false once an event this far into the future has been queued. Adjustable with setLookAhead
+#endif
+
 struct NullSchedAdjuster {
     //void reset() {}
     EventClockT::time_point adjust(EventClockT::time_point tp) const {
@@ -61,9 +76,21 @@ template <typename Interface=NullSchedulerInterface> class Scheduler : public Sc
     EventClockT::duration MAX_SLEEP; //need to call onIdleCpu handlers every so often, even if no events are ready.
     Interface interface;
     SchedAdjuster schedAdjuster;
-    bool hasActiveEvent;
+    RingBuffer<OutputEvent, SCHEDULER_QUEUE_LEN> _eventQueue; //events not yet handed to the interface, in the order they were queued
+    EventClockT::duration _lookAhead; //isRoomInBuffer() is false once an event this far past the current time has been queued
+    EventClockT::time_point _lastStepTime; //time of the last step handed to queueSteps
+    EventClockT::time_point _lastEventTime; //latest time of any event queued. Not necessarily that of _eventQueue.back(), since eg pulse-end events of different axes interleave
     public:
         void queue(const OutputEvent &evt);
+        //The interface may be able to render steps directly (see StepDirOutputs), bypassing the event queue:
+        static constexpr std::size_t maxRasterizedAxes() {
+            return Interface::maxRasterizedAxes();
+        }
+        inline void setStepDirOutputs(AxisIdType axis, const StepDirOutputs &outputs) {
+            interface.setStepDirOutputs(axis, outputs);
+        }
+        //Returns the number of steps queued, which is less than num if the rest aren't yet within the interface's scheduling window.
+        std::size_t queueSteps(const Event *steps, std::size_t num);
         void schedPwm(AxisIdType idx, float duty, float maxPeriod);
         template <typename T> void setMaxSleep(T duration) {
             MAX_SLEEP = std::chrono::duration_cast<EventClockT::duration>(duration);
@@ -71,31 +98,60 @@ template <typename Interface=NullSchedulerInterface> class Scheduler : public Sc
         inline void setDefaultMaxSleep() {
             setMaxSleep(std::chrono::milliseconds(40));
         }
+        template <typename T> void setLookAhead(T duration) {
+            _lookAhead = std::chrono::duration_cast<EventClockT::duration>(duration);
+        }
         Scheduler(Interface interface);
         //Event nextEvent(bool doSleep=true, std::chrono::microseconds timeout=std::chrono::microseconds(1000000));
         void initSchedThread() const; //call this from whatever threads call nextEvent to optimize that thread's priority.
         //EventClockT::time_point lastSchedTime() const; //get the time at which the last event is scheduled, or the current time if no events queued.
         bool isRoomInBuffer() const;
         void eventLoop();
-        void yield(const OutputEvent *evt);
     private:
+        void flushEvents();
         void sleepUntilEvent(const OutputEvent *evt) const;
-        bool isEventNear(const OutputEvent &evt) const;
-        bool isEventTime(const OutputEvent &evt) const;
 };
 
 template <typename Interface> Scheduler<Interface>::Scheduler(Interface interface) 
     : interface(interface)
-    ,hasActiveEvent(false)
+    ,_eventQueue()
+    ,_lookAhead(std::chrono::microseconds(SCHEDULER_LOOKAHEAD_US))
+    ,_lastStepTime()
+    ,_lastEventTime()
     {
     setDefaultMaxSleep();
 }
 
 
 template <typename Interface> void Scheduler<Interface>::queue(const OutputEvent &evt) {
-    hasActiveEvent = true;
-    this->yield(&evt);
-    hasActiveEvent = false;
+    //only block if there's no room in the queue, in which case wait for the front event to enter the interface's scheduling window.
+    //Note: onIdleCpu may be called re-entrantly while waiting, but isRoomInBuffer() is false during that time.
+    OnIdleCpuIntervalT intervalT = OnIdleCpuIntervalWide;
+    int numShortIntervals = 0; //need to track the number of short cpu intervals, because if we just execute short intervals constantly for, say, 1 second, then certain services that only run at long intervals won't occur. So make every, say, 10000th short interval transform into a wide interval.
+    while (_eventQueue.full()) {
+        flushEvents();
+        if (!_eventQueue.full()) {
+            break;
+        }
+        if (!interface.onIdleCpu(intervalT)) { //if we don't need any onIdleCpu, then sleep until the front event can be handed off
+            this->sleepUntilEvent(&_eventQueue.front());
+            intervalT = OnIdleCpuIntervalWide;
+        } else {
+            //after 2048 (just a nice binary number) short intervals, insert a wide interval instead:
+            intervalT = (++numShortIntervals % 2048) ? OnIdleCpuIntervalShort : OnIdleCpuIntervalWide;
+        }
+    }
+    _eventQueue.push_back(evt);
+    _lastEventTime = std::max(_lastEventTime, evt.time());
+    flushEvents();
+}
+
+template <typename Interface> std::size_t Scheduler<Interface>::queueSteps(const Event *steps, std::size_t num) {
+    std::size_t numQueued = interface.queueSteps(steps, num);
+    if (numQueued != 0) {
+        _lastStepTime = steps[numQueued-1].time();
+    }
+    return numQueued;
 }
 
 template <typename Interface> void Scheduler<Interface>::schedPwm(AxisIdType idx, float duty, float idealPeriod) {
@@ -116,7 +172,8 @@ template <typename Interface> void Scheduler<Interface>::initSchedThread() const
 }
 
 template <typename Interface> bool Scheduler<Interface>::isRoomInBuffer() const {
-    return !hasActiveEvent;
+    auto horizon = EventClockT::now() + _lookAhead;
+    return _lastStepTime <= horizon && (_eventQueue.empty() || (!_eventQueue.full() && _lastEventTime <= horizon));
 }
 
 
@@ -124,31 +181,33 @@ template <typename Interface> void Scheduler<Interface>::eventLoop() {
     OnIdleCpuIntervalT intervalT = OnIdleCpuIntervalWide;
     int numShortIntervals = 0; //need to track the number of short cpu intervals, because if we just execute short intervals constantly for, say, 1 second, then certain services that only run at long intervals won't occur. So make every, say, 10000th short interval transform into a wide interval.
     while (1) {
+        flushEvents();
         if (interface.onIdleCpu(intervalT)) {
             //intervalT = OnIdleCpuIntervalShort; //more cpu is needed; no delay
             intervalT = (++numShortIntervals % 2048) ? OnIdleCpuIntervalShort : OnIdleCpuIntervalWide;
         } else {
             intervalT = OnIdleCpuIntervalWide; //no cpu is needed; wide delay
-            sleepUntilEvent(NULL);
+            flushEvents(); //onIdleCpu may have queued events that are already due
+            sleepUntilEvent(_eventQueue.empty() ? NULL : &_eventQueue.front());
         }
     }
 }
 
-template <typename Interface> void Scheduler<Interface>::yield(const OutputEvent *evt) {
-    OnIdleCpuIntervalT intervalT = OnIdleCpuIntervalWide;
-    int numShortIntervals = 0; //need to track the number of short cpu intervals, because if we just execute short intervals constantly for, say, 1 second, then certain services that only run at long intervals won't occur. So make every, say, 10000th short interval transform into a wide interval.
-    while (!isEventTime(*evt)) {
-        if (!interface.onIdleCpu(intervalT)) { //if we don't need any onIdleCpu, then either sleep for event or yield to rest of program:
-            this->sleepUntilEvent(evt);
-            //break; //don't break because sleepUntilEvent won't always do the full sleep
-            intervalT = OnIdleCpuIntervalWide;
-            //numShortIntervals = 0;
-        } else {
-            //after 2048 (just a nice binary number) short intervals, insert a wide interval instead:
-            intervalT = (++numShortIntervals % 2048) ? OnIdleCpuIntervalShort : OnIdleCpuIntervalWide;
+template <typename Interface> void Scheduler<Interface>::flushEvents() {
+    //hand every event that has entered the interface's scheduling window over to the interface, a batch at a time.
+    //queueBatch stops at the first event beyond the interface's writable horizon; that event & those after it stay in _eventQueue.
+    std::array<OutputEvent, SCHEDULER_BATCH_LEN> batch;
+    std::size_t num, numQueued;
+    do {
+        num = std::min(batch.size(), _eventQueue.size());
+        for (std::size_t i=0; i<num; ++i) {
+            batch[i] = _eventQueue[i];
         }
-    }
-    interface.queue(*evt);
+        numQueued = num ? interface.queueBatch(batch.data(), num) : 0;
+        for (std::size_t i=0; i<numQueued; ++i) {
+            _eventQueue.pop_front();
+        }
+    } while (numQueued == batch.size());
 }
 
 template <typename Interface> void Scheduler<Interface>::sleepUntilEvent(const OutputEvent *evt) const {
@@ -165,13 +224,4 @@ template <typename Interface> void Scheduler<Interface>::sleepUntilEvent(const O
     SleepT::sleep_until(sleepUntil);
 }
 
-template <typename Interface> bool Scheduler<Interface>::isEventNear(const OutputEvent &evt) const {
-    auto thresh = EventClockT::now() + std::chrono::microseconds(20);
-    return interface.schedTime(schedAdjuster.adjust(evt.time())) <= thresh;
-}
-
-template <typename Interface> bool Scheduler<Interface>::isEventTime(const OutputEvent &evt) const {
-    return interface.schedTime(schedAdjuster.adjust(evt.time())) <= EventClockT::now();
-}
-
 #endif
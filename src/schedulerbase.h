@@ -40,6 +40,7 @@
 
 #include "drivers/auto/chronoclock.h" //for EventClockT
 #include "common/typesettings/enums.h" //for OnIdleCpuIntervalT
+#include "common/typesettings/primitives.h" //for AxisIdType
 
 #ifndef SCHED_PRIORITY
     #define SCHED_PRIORITY 30
@@ -51,6 +52,7 @@
 #define SCHED_MEM_EXIT_LEVEL 1
 
 class Event; //forward declaration to avoid inclusion of event.h (as event.h includes typesettings.h, which may include this file)
+struct StepDirOutputs;
 
 
 
@@ -76,6 +78,28 @@ struct NullSchedulerInterface {
                 //add this event to the hardware queue, waiting until schedTime(evt.time()) if necessary
                 assert(false); //DefaultSchedulerInterface::HardwareScheduler cannot queue!
             }
+            inline std::size_t queueBatch(const OutputEvent *evts, std::size_t num) {
+                //add `num` events (sorted by time) to the hardware queue, as if by calling queue on each one. Implementations may be able to merge events that share a time slot.
+                //Stop (without waiting) at the first event beyond writableHorizon(), and return the number of events queued.
+                auto horizon = writableHorizon();
+                std::size_t i = 0;
+                for (; i<num && evts[i].time() <= horizon; ++i) {
+                    queue(evts[i]);
+                }
+                return i;
+            }
+            static constexpr std::size_t maxRasterizedAxes() {
+                //return the number of axes (stepperIds [0, n)) whose steps queueSteps can write straight to the hardware without going through OutputEvents; 0 if queueSteps isn't implemented
+                return 0;
+            }
+            inline void setStepDirOutputs(AxisIdType /*axis*/, const StepDirOutputs &/*outputs*/) {
+                //Tell the hardware which outputs to produce for each step of the given axis (only called for axes below maxRasterizedAxes())
+            }
+            inline std::size_t queueSteps(const Event * /*steps*/, std::size_t /*num*/) {
+                //Output the step/direction sequence of each step, stopping at the first one that can't yet be scheduled. Return the number of steps queued.
+                assert(false); //DefaultSchedulerInterface::HardwareScheduler cannot queueSteps!
+                return 0;
+            }
             inline void queuePwm(int /*pin*/, float /*ratio*/, float /*maxPeriod*/) {
                 //Set the given pin to a pwm duty-cycle of `ratio` using a maximum period of maxPeriod (irrelevant if using PCM algorithm). Eg queuePwm(5, 0.4) sets pin #5 to a 40% duty cycle.
                 assert(false); //DefaultSchedulerInterface::HardwareScheduler cannot queuePwm!
@@ -85,6 +109,10 @@ struct NullSchedulerInterface {
                 //This function is only templated to prevent importing typesettings.h (circular import), required for the real EventClockT. An implementation only needs to support the EventClockT::time_point defined in common/typesettings.h
                 return evtTime;
             }
+            EventClockT::time_point writableHorizon() const {
+                //events up to this time can currently be queued without waiting
+                return EventClockT::now();
+            }
             bool onIdleCpu(OnIdleCpuIntervalT interval) {
                 (void)interval; //unused
                 return false; //no more cpu needed
@@ -106,12 +134,27 @@ struct NullSchedulerInterface {
         inline void queue(const OutputEvent &evt) {
             _hardwareScheduler.queue(evt);
         }
+        inline std::size_t queueBatch(const OutputEvent *evts, std::size_t num) {
+            return _hardwareScheduler.queueBatch(evts, num);
+        }
+        static constexpr std::size_t maxRasterizedAxes() {
+            return HardwareScheduler::maxRasterizedAxes();
+        }
+        inline void setStepDirOutputs(AxisIdType axis, const StepDirOutputs &outputs) {
+            _hardwareScheduler.setStepDirOutputs(axis, outputs);
+        }
+        inline std::size_t queueSteps(const Event *steps, std::size_t num) {
+            return _hardwareScheduler.queueSteps(steps, num);
+        }
         inline void queuePwm(int pin, float duty, float maxPeriod) {
             _hardwareScheduler.queuePwm(pin, duty, maxPeriod);
         }
         template <typename EventClockT_time_point> EventClockT_time_point schedTime(EventClockT_time_point evtTime) const {
             return _hardwareScheduler.schedTime(evtTime);
         }
+        EventClockT::time_point writableHorizon() const {
+            return _hardwareScheduler.writableHorizon();
+        }
 };
 
 #endif
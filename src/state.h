@@ -28,6 +28,13 @@
  *   tracking unit mode and axis position, and interfacing with the scheduler.
  * State controls the communications channel, the scheduler, and the underlying driver.
  * Motion planning is offloaded to src/motion/MotionPlanner
+ *
+ * If STATE_STEP_THREAD is set, then the MotionPlanner is driven from a thread of its own (see stepThreadLoop), so that eg a slow thermistor read or a burst of gcode can't delay step generation.
+ *   That thread receives movement commands through _pendingMotion and hands the resulting steps back to the scheduler thread through _stepRing. Both are lock-free single-producer/single-consumer queues.
+ *   The step thread touches nothing else in the State.
+ *
+ * Steps are output by outputSteps. The steps of any axis below the HardwareScheduler's maxRasterizedAxes() whose driver is a step/direction driver (see StepDirOutputs)
+ *   are rendered straight into the hardware's buffer; otherwise, each step is broken into its driver's OutputEvents and queued to the scheduler.
  */
 
 #ifndef STATE_H
@@ -53,6 +60,8 @@
 #include "event.h"
 #include "scheduler.h"
 #include "motion/motionplanner.h"
+#include "common/ringbuffer.h"
+#include "common/spscringbuffer.h"
 #include "common/mathutil.h"
 #include "drivers/iodriver.h"
 #include "drivers/auto/chronoclock.h" //for EventClockT
@@ -63,6 +72,33 @@
 #include "filesystem.h"
 #include "outputevent.h"
 
+#ifndef STATE_STEP_THREAD
+    #define STATE_STEP_THREAD USE_PTHREAD //generate steps on a separate thread (requires threading support)
+#endif
+#if STATE_STEP_THREAD
+    #include <atomic>
+    #include <thread>
+#endif
+
+#ifndef STATE_MOTION_QUEUE_LEN
+    #define STATE_MOTION_QUEUE_LEN 32 //number of G0/G1/G28 commands that can be acknowledged before they are handed to the MotionPlanner
+#endif
+#ifndef STATE_COALESCE_TOLERANCE
+    #define STATE_COALESCE_TOLERANCE 0.002 //mm. Consecutive G1s are merged into one move if it would stray no further than this from their path (and from their extrusion)
+#endif
+#ifndef STATE_STEP_BATCH_LEN
+    #define STATE_STEP_BATCH_LEN 64 //number of steps to request from the MotionPlanner at once
+#endif
+#ifndef STATE_STEP_RING_LEN
+    #define STATE_STEP_RING_LEN 2048 //number of steps the step thread may get ahead of the scheduler by (must be a power of two)
+#endif
+#ifndef STATE_COARSE_HOME_LOOKAHEAD_US
+    #define STATE_COARSE_HOME_LOOKAHEAD_US 2000 //during the fast approach of a two-phase home, steps may be generated this far ahead of their time (a slow home generates each step only once the last has been output)
+#endif
+#ifndef STATE_STEP_THREAD_IDLE_SLEEP_US
+    #define STATE_STEP_THREAD_IDLE_SLEEP_US 200 //time the step thread sleeps for when it has nothing to do, or when _stepRing is full
+#endif
+
 template <typename Drv> class State {
     //The scheduler needs to have certain callback functions, so we expose them without exposing the entire State:
     struct SchedInterface {
@@ -92,18 +128,48 @@ template <typename Drv> class State {
             inline void queue(const OutputEvent &evt) {
                 _hardwareScheduler.queue(evt);
             }
+            inline std::size_t queueBatch(const OutputEvent *evts, std::size_t num) {
+                return _hardwareScheduler.queueBatch(evts, num);
+            }
+            static constexpr std::size_t maxRasterizedAxes() {
+                return SchedInterfaceHardwareScheduler::maxRasterizedAxes();
+            }
+            inline void setStepDirOutputs(AxisIdType axis, const StepDirOutputs &outputs) {
+                _hardwareScheduler.setStepDirOutputs(axis, outputs);
+            }
+            inline std::size_t queueSteps(const Event *steps, std::size_t num) {
+                return _hardwareScheduler.queueSteps(steps, num);
+            }
             inline void queuePwm(int pin, float duty, float maxPeriod) {
                 _hardwareScheduler.queuePwm(pin, duty, maxPeriod);
             }
             template <typename EventClockT_time_point> EventClockT_time_point schedTime(EventClockT_time_point evtTime) const {
                 return _hardwareScheduler.schedTime(evtTime);
             }
+            EventClockT::time_point writableHorizon() const {
+                return _hardwareScheduler.writableHorizon();
+            }
     };
     //The MotionPlanner needs certain information about the physical machine, so we provide that without exposing all of Drv:
     struct MotionInterface {
         typedef typename Drv::CoordMapT CoordMapT;
         typedef typename Drv::AxisStepperTypes AxisStepperTypes;
     };
+    //A movement command that has been acknowledged to the host, but not yet accepted by the MotionPlanner:
+    struct PendingMotion {
+        bool isHome; //true if this is a homing move (in which case only maxVelXyz, homeBackOff & isCoarseHome are used)
+        float homeBackOff; //if nonzero, the axes back off of the endstops by this distance (mm), rather than homing to them
+        bool isCoarseHome; //true for the fast approach (& back-off) of a two-phase home, which needn't find the endstops precisely
+        bool isArc; //true if this is an arc (G2/G3) about (centerX, centerY)
+        bool isClockwise;
+        float x, y, z, e; //destination, in primitive units
+        float centerX, centerY; //only used if isArc
+        float maxVelXyz;
+        //used to merge consecutive linear moves (see coalesceMotion):
+        bool hasStart; //false if the start position isn't known (eg the move follows a homing move)
+        float startX, startY, startZ, startE; //the previous move's destination
+        float deviation, eDeviation; //how far the moves merged into this one may stray from the straight line between its start & destination
+    };
     typedef Scheduler<SchedInterface> SchedType;
     PositionMode _positionMode; // = POS_ABSOLUTE;
     PositionMode _extruderPosMode; // = POS_RELATIVE; //set via M82 and M83
@@ -113,7 +179,26 @@ template <typename Drv> class State {
     float _destMoveRatePrimitive;
     float _hostZeroX, _hostZeroY, _hostZeroZ, _hostZeroE; //the host can set any arbitrary point to be referenced as 0.
     bool _isHomed;
+    bool _isDestKnown; //false after homing, until a move is made to an absolute position (the homed position is only known to the motionPlanner)
     EventClockT::time_point _lastMotionPlannedTime;
+    bool _isCoarseHome; //true while the motionPlanner carries out a PendingMotion with isCoarseHome set
+    //number of moves merged into the one before them by coalesceMotion (reported by M115), & its value when the current M32 print began:
+    #if STATE_STEP_THREAD
+        std::atomic<std::size_t> _numMergedMoves; //incremented by the step thread
+    #else
+        std::size_t _numMergedMoves;
+    #endif
+    std::size_t _numMergedMovesAtPrintStart;
+    //Movement commands are acked as soon as they're placed in this queue, so that the host isn't stalled for the duration of a move.
+    //They are fed to the motionPlanner from onIdleCpu (or from the step thread) as it makes room for them.
+    #if STATE_STEP_THREAD
+        SpscRingBuffer<PendingMotion, STATE_MOTION_QUEUE_LEN> _pendingMotion;
+    #else
+        RingBuffer<PendingMotion, STATE_MOTION_QUEUE_LEN> _pendingMotion;
+    #endif
+    //Steps are pulled from the motionPlanner in batches. _stepBatch[_stepBatchIdx:_stepBatchLen] are the steps that have yet to be sent to the scheduler.
+    std::array<Event, STATE_STEP_BATCH_LEN> _stepBatch;
+    std::size_t _stepBatchIdx, _stepBatchLen;
     gparse::Com com;
     //M32 allows a gcode file to call subroutines, essentially.
     //  These subroutines can then call more subroutines, so what we have is essentially a call stack.
@@ -122,10 +207,17 @@ template <typename Drv> class State {
     //Thus, we need a root com ("com") & an additional file stack ("gcodeFileStack").
     std::stack<gparse::Com> gcodeFileStack;
     SchedType scheduler;
-    MotionPlanner<MotionInterface, typename Drv::AccelerationProfileT> motionPlanner;
+    MotionPlanner<MotionInterface, typename Drv::AccelerationProfileT, typename Drv::InputShaperT> motionPlanner;
     Drv &driver;
     FileSystem &filesystem;
     typename Drv::IODriverTypes ioDrivers;
+    std::array<bool, std::tuple_size<typename Drv::IODriverTypes>::value> _isAxisRasterized; //true for each ioDriver whose steps are rendered by scheduler.queueSteps
+    #if STATE_STEP_THREAD
+        SpscRingBuffer<Event, STATE_STEP_RING_LEN> _stepRing; //steps produced by the step thread, waiting to be output by the scheduler thread
+        std::atomic<bool> _motionActive; //set by the step thread while there is motion still to be planned
+        std::atomic<bool> _stepThreadExit; //tells the step thread to stop
+        std::thread _stepThread;
+    #endif
     public:
         //so-called "Primitive" units represent a cartesian coordinate from the origin, using some primitive unit (mm)
         static constexpr CelciusType DEFAULT_HOTEND_TEMP() { return -300; } // < absolute 0
@@ -136,6 +228,7 @@ template <typename Drv> class State {
         //  But if we want to continue reading from that original com channel while simultaneously reading from the new gcode file, then 'needPersistentCom' should be set to true.
         //  This is normally only relevant for communication with a host, like Octoprint, where we want temperature reading, emergency stop, etc to still work.
         State(Drv &drv, FileSystem &fs, gparse::Com com, bool needPersistentCom);
+        ~State();
         /* Control interpretation of positions from the host as relative or absolute */
         PositionMode positionMode() const;
         void setPositionMode(PositionMode mode);
@@ -180,25 +273,73 @@ template <typename Drv> class State {
         gparse::Response execute(gparse::Command const& cmd, gparse::Com &com);
         /* Calculate and schedule a movement to absolute-valued x, y, z, e coords from the last queued position */
         void queueMovement(float x, float y, float z, float e);
-        /* Home to the endstops. Does not return until endstops have been reached. */
+        /* Schedule an arc in the XY plane about (centerX, centerY) from the last queued position to absolute-valued x, y, z, e coords */
+        void queueArc(float x, float y, float z, float e, float centerX, float centerY, bool isClockwise);
+        /* Queue a move that homes to the endstops. The move will begin once all previously queued moves are complete. */
         void homeEndstops();
+        /* Number of entries in _pendingMotion needed by a call to homeEndstops() */
+        std::size_t numHomeMotions() const;
+        /* Number of moves that have been merged into a neighbor (and so weren't planned separately) since startup */
+        std::size_t numMergedMoves() const;
+    private:
+        /* True if the motionPlanner may be asked for its next step while homing, which depends upon the state of the endstops */
+        bool isHomeStepDue() const;
+        /* Hand as many pending movement commands to the motionPlanner as it has room for */
+        void feedMotionPlanner();
+        /* Merge the moves that follow the front of _pendingMotion into it, for as long as they continue along the same line & extrude at the same rate */
+        void coalesceMotion();
+        /* Fill in the start position of a movement command that goes to (x, y, z, e) */
+        void setMotionStart(PendingMotion &m);
+        /* Send steps to the scheduler until it runs out of room. Returns the number of steps that were sent */
+        std::size_t outputSteps(const Event *steps, std::size_t num);
+        #if STATE_STEP_THREAD
+            /* Body of the step thread: pull steps from the motionPlanner and push them into _stepRing until told to exit */
+            void stepThreadLoop();
+            /* Do one round of step generation on the step thread. Returns false if there was nothing to do */
+            bool generateSteps();
+        #endif
+    public:
         /* Set the hotend fan to a duty cycle between 0.0 and 1.0 */
         void setFanRate(float rate);
 };
 
 
+struct __setStepDirOutputs {
+    template <typename T, typename SchedT, typename FlagsT> void operator()(std::size_t index, T &driver, SchedT *sched, FlagsT *isRasterized) {
+        StepDirOutputs outputs = driver.getStepDirOutputs();
+        //drivers beyond the scheduler's capacity fall back to OutputEvents
+        (*isRasterized)[index] = index < SchedT::maxRasterizedAxes() && outputs.isValid();
+        if ((*isRasterized)[index]) {
+            sched->setStepDirOutputs(index, outputs);
+        }
+    }
+};
+
 template <typename Drv> State<Drv>::State(Drv &drv, FileSystem &fs, gparse::Com com, bool needPersistentCom)
     : _positionMode(POS_ABSOLUTE), _extruderPosMode(POS_ABSOLUTE),  
     unitMode(UNIT_MM), 
     _destXPrimitive(0), _destYPrimitive(0), _destZPrimitive(0), _destEPrimitive(0),
     _hostZeroX(0), _hostZeroY(0), _hostZeroZ(0), _hostZeroE(0),
     _isHomed(false),
+    _isDestKnown(false),
     _lastMotionPlannedTime(std::chrono::seconds(0)), 
+    _isCoarseHome(false),
+    _numMergedMoves(0), _numMergedMovesAtPrintStart(0),
+    _pendingMotion(),
+    _stepBatch(), _stepBatchIdx(0), _stepBatchLen(0),
     scheduler(SchedInterface(*this)),
     driver(drv),
-    filesystem(fs)
+    filesystem(fs),
+    _isAxisRasterized()
+    #if STATE_STEP_THREAD
+        , _stepRing(), _motionActive(false), _stepThreadExit(false), _stepThread()
+    #endif
     {
     this->setDestMoveRatePrimitive(this->driver.defaultMoveRate());
+    callOnAll(ioDrivers, __setStepDirOutputs(), &scheduler, &_isAxisRasterized);
+    for (std::size_t axis=0; axis<MotionInterface::CoordMapT::numAxis(); ++axis) {
+        motionPlanner.setAxisLimits(axis, this->driver.maxAxisVel(axis), this->driver.maxAxisAccel(axis));
+    }
     if (needPersistentCom) {
         this->com = com;
     } else {
@@ -206,6 +347,15 @@ template <typename Drv> State<Drv>::State(Drv &drv, FileSystem &fs, gparse::Com
     }
 }
 
+template <typename Drv> State<Drv>::~State() {
+    #if STATE_STEP_THREAD
+        _stepThreadExit = true;
+        if (_stepThread.joinable()) {
+            _stepThread.join();
+        }
+    #endif
+}
+
 
 template <typename Drv> PositionMode State<Drv>::positionMode() const {
     return this->_positionMode;
@@ -348,30 +498,130 @@ template <typename Drv> bool State<Drv>::onIdleCpu(OnIdleCpuIntervalT interval)
         }
     }
     bool motionNeedsCpu = false;
+    #if STATE_STEP_THREAD
+    //Steps are generated on the step thread; just pass along whatever OutputEvents it has ready.
+    //While there's motion, the scheduler mustn't sleep for long, or the events the step thread produces in the meantime would be late.
+    if (_motionActive || _pendingMotion.size() != 0) {
+        this->scheduler.setMaxSleep(std::chrono::milliseconds(1));
+    } else {
+        this->scheduler.setDefaultMaxSleep();
+    }
+    //Steps are copied out of the ring in batches (outputSteps needs them contiguous), and only popped once they've been output.
+    //Note: scheduler.queue may call onIdleCpu re-entrantly, but that call won't touch the ring since the scheduler has no room during it.
+    std::array<Event, STATE_STEP_BATCH_LEN> steps;
+    std::size_t numOutput = 0;
+    std::size_t numReady = _stepRing.size();
+    while (numReady != 0 && scheduler.isRoomInBuffer()) {
+        std::size_t len = std::min(numReady, steps.size());
+        for (std::size_t i=0; i<len; ++i) {
+            steps[i] = _stepRing[i];
+        }
+        numOutput = outputSteps(steps.data(), len);
+        for (std::size_t i=0; i<numOutput; ++i) {
+            _stepRing.pop_front();
+        }
+        numReady -= numOutput;
+        if (numOutput != len) {
+            break;
+        }
+    }
+    //(if steps remain but none could be output, they're beyond what the hardware can accept yet; no point spinning on them)
+    motionNeedsCpu = numReady != 0 && numOutput != 0 && scheduler.isRoomInBuffer();
+    #else
+    feedMotionPlanner();
+    motionPlanner.sampleEndstops(); //(only does anything while homing)
     if (scheduler.isRoomInBuffer()) { 
         //LOGV("State::satisfyIOs, sched has buffer room\n");
-        Event evt; //check to see if motionPlanner has another event ready
-        if (!motionPlanner.isHoming() || _lastMotionPlannedTime <= EventClockT::now()) { //if we're homing, we don't want to queue the next step until the current one has actually completed.
-            if (!(evt = motionPlanner.nextStep()).isNull()) {
-                //this->scheduler.queue(evt);
-                //iterEventOutputSequence(evt, [this](const OutputEvent &out) {this->scheduler.queue(out); });
-                tupleCallOnIndex(this->ioDrivers, __iterEventOutputSequence(), evt.stepperId(), evt, [this](const OutputEvent &out) { this->scheduler.queue(out); });
-                _lastMotionPlannedTime = evt.time();
-                motionNeedsCpu = scheduler.isRoomInBuffer();
-            } else { //counter buffer changes set in homing
+        //check to see if motionPlanner has more events ready
+        if (_stepBatchIdx == _stepBatchLen && (!motionPlanner.isHoming() || isHomeStepDue())) {
+            _stepBatchIdx = 0;
+            _stepBatchLen = motionPlanner.nextSteps(_stepBatch.data(), _stepBatch.size());
+            if (_stepBatchLen == 0) { //counter buffer changes set in homing
                 this->scheduler.setDefaultMaxSleep();
+            } else {
+                //the next motion must be planned after the last step generated, not just the last one output (the rest of the batch may not have been sent yet)
+                _lastMotionPlannedTime = _stepBatch[_stepBatchLen-1].time();
             }
         }
+        //Send the whole batch to the scheduler. Note that scheduler.queue may call onIdleCpu re-entrantly, but that call won't touch the batch since the scheduler has no room during it.
+        std::size_t numOutput = outputSteps(&_stepBatch[_stepBatchIdx], _stepBatchLen - _stepBatchIdx);
+        _stepBatchIdx += numOutput;
+        //(if steps remain but none could be output, they're beyond what the hardware can accept yet; no point spinning on them)
+        motionNeedsCpu = _stepBatchLen != 0 && scheduler.isRoomInBuffer() && (numOutput != 0 || _stepBatchIdx == _stepBatchLen);
+    }
+    if (!motionNeedsCpu) {
+        motionPlanner.prepareNextSegment(); //nothing more can be done for the current segment, so get the next one ready in the meantime.
     }
+    #endif
     bool driversNeedCpu = drv::IODriver::callIdleCpuHandlers<typename Drv::IODriverTypes, SchedType&>(this->ioDrivers, this->scheduler);
     return motionNeedsCpu || driversNeedCpu;
 }
 
+template <typename Drv> std::size_t State<Drv>::outputSteps(const Event *steps, std::size_t num) {
+    //Runs of steps on rasterized axes are handed to the scheduler together; any other step is broken into its driver's OutputEvents.
+    std::size_t idx = 0;
+    while (idx != num && scheduler.isRoomInBuffer()) {
+        if (_isAxisRasterized[steps[idx].stepperId()]) {
+            std::size_t runEnd = idx+1;
+            while (runEnd != num && _isAxisRasterized[steps[runEnd].stepperId()]) {
+                ++runEnd;
+            }
+            std::size_t numQueued = scheduler.queueSteps(steps+idx, runEnd-idx);
+            idx += numQueued;
+            if (idx != runEnd) {
+                break; //the rest of the run can't be scheduled yet
+            }
+        } else {
+            const Event &evt = steps[idx++];
+            tupleCallOnIndex(this->ioDrivers, __iterEventOutputSequence(), evt.stepperId(), evt, [this](const OutputEvent &out) { this->scheduler.queue(out); });
+        }
+    }
+    return idx;
+}
+
 template <typename Drv> void State<Drv>::eventLoop() {
+    #if STATE_STEP_THREAD
+        _stepThread = std::thread(&State<Drv>::stepThreadLoop, this);
+    #endif
     this->scheduler.initSchedThread();
     this->scheduler.eventLoop();
 }
 
+#if STATE_STEP_THREAD
+template <typename Drv> void State<Drv>::stepThreadLoop() {
+    this->scheduler.initSchedThread(); //the step thread needs to keep ahead of the scheduler, so give it the same priority.
+    while (!_stepThreadExit) {
+        if (!generateSteps()) {
+            SleepT::sleep_for(std::chrono::microseconds(STATE_STEP_THREAD_IDLE_SLEEP_US));
+        }
+    }
+}
+
+template <typename Drv> bool State<Drv>::generateSteps() {
+    if (!_pendingMotion.empty()) {
+        _motionActive = true; //set before the command leaves _pendingMotion, so that the scheduler thread always sees at least one of them.
+    }
+    feedMotionPlanner();
+    motionPlanner.sampleEndstops(); //(only does anything while homing)
+    bool didWork = false;
+    if (_stepBatchIdx == _stepBatchLen && (!motionPlanner.isHoming() || (_stepRing.empty() && isHomeStepDue()))) {
+        _stepBatchIdx = 0;
+        _stepBatchLen = motionPlanner.nextSteps(_stepBatch.data(), _stepBatch.size());
+    }
+    while (_stepBatchIdx != _stepBatchLen && !_stepRing.full()) {
+        Event evt = _stepBatch[_stepBatchIdx++];
+        _stepRing.push_back(evt);
+        _lastMotionPlannedTime = evt.time();
+        didWork = true;
+    }
+    _motionActive = _stepBatchIdx != _stepBatchLen || !_pendingMotion.empty() || !motionPlanner.readyForNextHome();
+    if (!didWork) {
+        didWork = motionPlanner.prepareNextSegment(); //no steps could be generated just now, so get the next segment ready in the meantime.
+    }
+    return didWork;
+}
+#endif
+
 template <typename Drv> void State<Drv>::tendComChannel(gparse::Com &com) {
     if (com.tendCom()) {
         //note: may want to optimize this; once there is a pending command, this involves a lot of extra work.
@@ -392,12 +642,15 @@ template <typename Drv> void State<Drv>::tendComChannel(gparse::Com &com) {
 template <typename Drv> gparse::Response State<Drv>::execute(gparse::Command const &cmd, gparse::Com &com) {
     std::string opcode = cmd.getOpcode();
     //gparse::Command resp;
-    if (cmd.isG0() || cmd.isG1()) { //rapid movement / controlled (linear) movement (currently uses same code)
+    if (cmd.isG0() || cmd.isG1() || cmd.isG2() || cmd.isG3()) { //rapid movement / controlled (linear) movement (currently uses same code) / clockwise arc / counter-clockwise arc
         //LOGW("Warning (gparse/state.h): OP_G0/1 (linear movement) not fully implemented - notably extrusion\n");
         if (!_isHomed && driver.doHomeBeforeFirstMovement()) {
+            if (_pendingMotion.capacity() - _pendingMotion.size() < numHomeMotions()) {
+                return gparse::Response::Null;
+            }
             this->homeEndstops();
         }
-        if (!motionPlanner.readyForNextMove()) { //don't queue another command unless we have the memory for it.
+        if (_pendingMotion.full()) { //don't queue another command unless we have the memory for it.
             return gparse::Response::Null;
         }
         bool hasX, hasY, hasZ, hasE;
@@ -419,7 +672,43 @@ template <typename Drv> gparse::Response State<Drv>::execute(gparse::Command con
             //this->setDestFeedRatePrimitive(fUnitToPrimitive(f));
             this->setDestMoveRatePrimitive(fUnitToPrimitive(f));
         }
-        this->queueMovement(x, y, z, e);
+        if (cmd.isG2() || cmd.isG3()) {
+            if (!motionPlanner.supportsArcs()) {
+                throw std::runtime_error("G2/G3 (arc movement) is not supported by this machine's AxisSteppers");
+            }
+            //The arc center is given either as an offset (I, J) from the current position, or by the radius (R)
+            bool hasI, hasJ, hasR;
+            float i = cmd.getI(hasI);
+            float j = cmd.getJ(hasJ);
+            float r = cmd.getR(hasR);
+            if (hasI || hasJ) {
+                this->queueArc(x, y, z, e, curX + (hasI ? posUnitToMM(i) : 0), curY + (hasJ ? posUnitToMM(j) : 0), cmd.isG2());
+            } else if (hasR) {
+                //There are two arcs of radius |R| through both points; a negative R selects the one that spans more than 180 degrees.
+                //This is the same construction as Grbl uses.
+                r = posUnitToMM(r);
+                float dx = x - curX;
+                float dy = y - curY;
+                float hSq = 4*r*r - dx*dx - dy*dy;
+                if (hSq < 0) {
+                    LOGW("Warning (gparse/state.h): G2/G3 radius is too small to reach the destination; using a semicircle\n");
+                    hSq = 0;
+                }
+                float hOverD = -std::sqrt(hSq) / std::sqrt(dx*dx + dy*dy); //distance from the chord midpoint to the center, over half the chord length
+                if (cmd.isG3()) {
+                    hOverD = -hOverD;
+                }
+                if (r < 0) {
+                    hOverD = -hOverD;
+                }
+                this->queueArc(x, y, z, e, curX + 0.5f*(dx - dy*hOverD), curY + 0.5f*(dy + dx*hOverD), cmd.isG2());
+            } else {
+                LOGW("Warning (gparse/state.h): G2/G3 without I, J or R; treating as a linear move\n");
+                this->queueMovement(x, y, z, e);
+            }
+        } else {
+            this->queueMovement(x, y, z, e);
+        }
         return gparse::Response::Ok;
     } else if (cmd.isG20()) { //g-code coordinates will now be interpreted as inches
         setUnitMode(UNIT_IN);
@@ -428,7 +717,7 @@ template <typename Drv> gparse::Response State<Drv>::execute(gparse::Command con
         setUnitMode(UNIT_MM);
         return gparse::Response::Ok;
     } else if (cmd.isG28()) { //home to end-stops / zero coordinates
-        if (!motionPlanner.readyForNextMove()) { //don't queue another command unless we have the memory for it.
+        if (_pendingMotion.capacity() - _pendingMotion.size() < numHomeMotions()) { //don't queue another command unless we have the memory for it.
             return gparse::Response::Null;
         }
         this->homeEndstops();
@@ -472,6 +761,7 @@ template <typename Drv> gparse::Response State<Drv>::execute(gparse::Command con
     } else if (cmd.isM32()) { //select file on SD card and print:
         LOGV("loading gcode: %s\n", cmd.getFilepathParam().c_str());
         gcodeFileStack.push(gparse::Com(filesystem.relGcodePathToAbs(cmd.getFilepathParam())));
+        _numMergedMovesAtPrintStart = numMergedMoves();
         return gparse::Response::Ok;
     } else if (cmd.isM82()) { //set extruder absolute mode
         setExtruderPosMode(POS_ABSOLUTE);
@@ -487,6 +777,7 @@ template <typename Drv> gparse::Response State<Drv>::execute(gparse::Command con
         //note: can't simply pop the top file, because then that causes memory access errors when trying to send it a reply.
         //Need to check if com channel that received this command is the top one. If yes, then pop it and return Response::Null so that no response will be sent.
         //  else, pop it and return Response::Ok.
+        LOG("merged %u moves into their neighbors during this print\n", (unsigned)(numMergedMoves() - _numMergedMovesAtPrintStart));
         if (gcodeFileStack.empty()) { //return from the main I/O routine = kill program
             exit(0);
             return gparse::Response::Null;
@@ -540,6 +831,8 @@ template <typename Drv> gparse::Response State<Drv>::execute(gparse::Command con
     } else if (cmd.isM112()) { //emergency stop
         exit(1);
         return gparse::Response::Ok;
+    } else if (cmd.isM115()) { //get firmware info
+        return gparse::Response(gparse::ResponseOk, "FIRMWARE_NAME:Printipi MERGED_MOVES:" + std::to_string(numMergedMoves()));
     } else if (cmd.isM117()) { //print message
         return gparse::Response::Ok;
     } else if (cmd.isM140()) { //set BED temp and return immediately.
@@ -558,22 +851,163 @@ template <typename Drv> gparse::Response State<Drv>::execute(gparse::Command con
     }
 }
         
+template <typename Drv> void State<Drv>::setMotionStart(PendingMotion &m) {
+    m.hasStart = _isDestKnown;
+    std::tie(m.startX, m.startY, m.startZ, m.startE) = std::make_tuple(_destXPrimitive, _destYPrimitive, _destZPrimitive, _destEPrimitive);
+    m.deviation = m.eDeviation = 0;
+    _isDestKnown = true;
+}
+
 template <typename Drv> void State<Drv>::queueMovement(float x, float y, float z, float e) {
+    //Note: it is illegal to call this if _pendingMotion is full.
+    PendingMotion m;
+    m.isHome = false;
+    m.isArc = false;
+    std::tie(m.x, m.y, m.z, m.e) = std::make_tuple(x, y, z, e);
+    setMotionStart(m);
     _destXPrimitive = x;
     _destYPrimitive = y;
     _destZPrimitive = z;
     _destEPrimitive = e;
-    //now determine the velocity (must ensure xyz velocity doesn't cause too much E velocity):
-    float velXyz = destMoveRatePrimitive();
-    float minExtRate = -this->driver.maxRetractRate();
-    float maxExtRate = this->driver.maxExtrudeRate();
-    motionPlanner.moveTo(std::max(_lastMotionPlannedTime, EventClockT::now()), x, y, z, e, velXyz, minExtRate, maxExtRate);
+    m.maxVelXyz = destMoveRatePrimitive();
+    _pendingMotion.push_back(m);
+    #if !STATE_STEP_THREAD
+        feedMotionPlanner(); //(with a step thread, only that thread may touch the motionPlanner)
+    #endif
+}
+
+template <typename Drv> void State<Drv>::queueArc(float x, float y, float z, float e, float centerX, float centerY, bool isClockwise) {
+    //Note: it is illegal to call this if _pendingMotion is full.
+    PendingMotion m;
+    m.isHome = false;
+    m.isArc = true;
+    m.isClockwise = isClockwise;
+    std::tie(m.x, m.y, m.z, m.e) = std::make_tuple(x, y, z, e);
+    setMotionStart(m);
+    _destXPrimitive = x;
+    _destYPrimitive = y;
+    _destZPrimitive = z;
+    _destEPrimitive = e;
+    std::tie(m.centerX, m.centerY) = std::make_tuple(centerX, centerY);
+    m.maxVelXyz = destMoveRatePrimitive();
+    _pendingMotion.push_back(m);
+    #if !STATE_STEP_THREAD
+        feedMotionPlanner(); //(with a step thread, only that thread may touch the motionPlanner)
+    #endif
+}
+
+template <typename Drv> std::size_t State<Drv>::numHomeMotions() const {
+    return driver.homeApproachRate() > driver.clampHomeRate(destMoveRatePrimitive()) ? 3 : 1;
+}
+
+template <typename Drv> std::size_t State<Drv>::numMergedMoves() const {
+    return _numMergedMoves;
 }
 
 template <typename Drv> void State<Drv>::homeEndstops() {
-    this->scheduler.setMaxSleep(std::chrono::milliseconds(1));
-    motionPlanner.homeEndstops(std::max(_lastMotionPlannedTime, EventClockT::now()), this->driver.clampHomeRate(destMoveRatePrimitive()));
+    //Note: it is illegal to call this unless _pendingMotion has room for numHomeMotions() more entries.
+    PendingMotion m;
+    m.isHome = true;
+    m.isArc = false;
+    m.x = m.y = m.z = m.e = 0;
+    m.hasStart = false;
+    m.homeBackOff = 0;
+    m.isCoarseHome = false;
+    float homeRate = this->driver.clampHomeRate(destMoveRatePrimitive());
+    if (numHomeMotions() > 1) {
+        //A slow approach finds the endstops precisely, but takes a long time over the full height of the machine.
+        //So find them quickly first, then back off a short way and approach them again slowly.
+        m.isCoarseHome = true;
+        m.maxVelXyz = this->driver.homeApproachRate();
+        _pendingMotion.push_back(m);
+        m.homeBackOff = this->driver.homeBackOffDist();
+        _pendingMotion.push_back(m);
+        m.homeBackOff = 0;
+        m.isCoarseHome = false;
+    }
+    m.maxVelXyz = homeRate;
+    _pendingMotion.push_back(m);
     this->_isHomed = true;
+    this->_isDestKnown = false;
+    #if !STATE_STEP_THREAD
+        feedMotionPlanner(); //(with a step thread, only that thread may touch the motionPlanner)
+    #endif
+}
+
+template <typename Drv> bool State<Drv>::isHomeStepDue() const {
+    //Each step of a slow home isn't generated until the last has actually been output, so that it reflects the state of the endstops at that time.
+    //A coarse home may get a little ahead, as overshooting the endstop slightly doesn't matter (and the endstops are still sampled in the meantime).
+    auto lookahead = std::chrono::microseconds(_isCoarseHome ? STATE_COARSE_HOME_LOOKAHEAD_US : 0);
+    return _lastMotionPlannedTime <= EventClockT::now() + lookahead;
+}
+
+template <typename Drv> void State<Drv>::feedMotionPlanner() {
+    while (!_pendingMotion.empty()) {
+        if (_pendingMotion.front().isHome) {
+            const PendingMotion &m = _pendingMotion.front();
+            if (!motionPlanner.readyForNextHome()) {
+                return;
+            }
+            #if !STATE_STEP_THREAD
+                this->scheduler.setMaxSleep(std::chrono::milliseconds(1)); //(with a step thread, onIdleCpu does this)
+            #endif
+            _isCoarseHome = m.isCoarseHome;
+            motionPlanner.homeEndstops(std::max(_lastMotionPlannedTime, EventClockT::now()), m.maxVelXyz, m.homeBackOff);
+        } else {
+            if (!motionPlanner.readyForNextMove()) {
+                return;
+            }
+            coalesceMotion(); //merge any run of collinear moves that has built up, as late as possible
+            const PendingMotion &m = _pendingMotion.front();
+            //now determine the velocity (must ensure xyz velocity doesn't cause too much E velocity):
+            float minExtRate = -this->driver.maxRetractRate();
+            float maxExtRate = this->driver.maxExtrudeRate();
+            if (m.isArc) {
+                motionPlanner.moveArc(std::max(_lastMotionPlannedTime, EventClockT::now()), m.x, m.y, m.z, m.e, m.centerX, m.centerY, m.isClockwise, m.maxVelXyz, minExtRate, maxExtRate, this->driver.junctionDeviation(), this->driver.pressureAdvance());
+            } else if (!motionPlanner.moveTo(std::max(_lastMotionPlannedTime, EventClockT::now()), m.x, m.y, m.z, m.e, m.maxVelXyz, minExtRate, maxExtRate, this->driver.junctionDeviation(), this->driver.pressureAdvance())) {
+                return; //the move was divided to follow the bed mesh, and not all of it fit in the planner's queue. The rest is queued once there's room.
+            }
+        }
+        _pendingMotion.pop_front();
+    }
+}
+
+template <typename Drv> void State<Drv>::coalesceMotion() {
+    //Slicers often emit long runs of short, nearly collinear G1s (eg where a curved surface was tessellated). Each would be planned
+    //  (and have its AxisSteppers initialized) separately, so merge them into one move where that doesn't change the path by more than STATE_COALESCE_TOLERANCE.
+    //This only happens once moves have backed up behind the motionPlanner; otherwise they're handed to it as soon as they arrive.
+    //Moves are merged by extending the second to begin where the first does, and then dropping the first.
+    while (_pendingMotion.size() > 1) {
+        const PendingMotion &m = _pendingMotion[0];
+        PendingMotion &next = _pendingMotion[1];
+        if (m.isHome || m.isArc || !m.hasStart || next.isHome || next.isArc || m.maxVelXyz != next.maxVelXyz) {
+            return;
+        }
+        //S is the start of m, A is where m ends & next begins, and B is where next ends:
+        float sax = m.x - m.startX, say = m.y - m.startY, saz = m.z - m.startZ;
+        float sbx = next.x - m.startX, sby = next.y - m.startY, sbz = next.z - m.startZ;
+        float lenSA = std::sqrt(sax*sax + say*say + saz*saz);
+        float lenSB = std::sqrt(sbx*sbx + sby*sby + sbz*sbz);
+        float dotAB = sax*(next.x - m.x) + say*(next.y - m.y) + saz*(next.z - m.z);
+        if (!(lenSA > 0) || !(dotAB > 0)) {
+            return; //extrusion-only moves, & reversals, aren't merged.
+        }
+        //A's distance from the line SB, plus whatever the moves merged into m already strayed from the line SA (the change in direction swings them no further than A):
+        float crossX = say*sbz - saz*sby, crossY = saz*sbx - sax*sbz, crossZ = sax*sby - say*sbx;
+        float deviation = m.deviation + std::sqrt(crossX*crossX + crossY*crossY + crossZ*crossZ)/lenSB;
+        //likewise for the extruder, which moves in proportion to the distance along SB:
+        float frac = (sax*sbx + say*sby + saz*sbz) / (lenSB*lenSB);
+        float eDeviation = m.eDeviation + std::fabs(m.e - (m.startE + frac*(next.e - m.startE)));
+        if (deviation > STATE_COALESCE_TOLERANCE || eDeviation > STATE_COALESCE_TOLERANCE) {
+            return;
+        }
+        next.hasStart = true;
+        std::tie(next.startX, next.startY, next.startZ, next.startE) = std::make_tuple(m.startX, m.startY, m.startZ, m.startE);
+        next.deviation = deviation;
+        next.eDeviation = eDeviation;
+        _pendingMotion.pop_front();
+        ++_numMergedMoves;
+    }
 }
 
 /* State utility class for setting the fan rate (State::setFanRate).
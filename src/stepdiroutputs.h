@@ -0,0 +1,59 @@
+/* The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Colin Wallace
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+ 
+/* 
+ * Printipi/stepdiroutputs.h
+ *
+ * StepDirOutputs describes the OutputEvents that a step/direction stepper driver (eg the A4988) produces for each step:
+ *   at the step's time, the direction pin is set (high=forward) and the step pin is pulled low, and pulseWidth later the step pin returns high.
+ * Since that pattern is fixed for a given driver, a HardwareScheduler capable of it can render steps directly into its output buffer,
+ *   without ever constructing the OutputEvents (see HardwareScheduler::queueSteps).
+ */
+ 
+#ifndef STEPDIROUTPUTS_H
+#define STEPDIROUTPUTS_H
+
+#include <array>
+#include <chrono>
+#include "common/typesettings/primitives.h" //for GpioPinIdType
+#include "outputevent.h"
+#include "event.h"
+
+struct StepDirOutputs {
+    GpioPinIdType dirPin;
+    GpioPinIdType stepPin;
+    std::chrono::microseconds pulseWidth;
+    //default: the driver doesn't produce step/direction outputs.
+    StepDirOutputs() : dirPin(-1), stepPin(-1), pulseWidth(0) {}
+    StepDirOutputs(GpioPinIdType dirPin, GpioPinIdType stepPin, std::chrono::microseconds pulseWidth) : dirPin(dirPin), stepPin(stepPin), pulseWidth(pulseWidth) {}
+    inline bool isValid() const {
+        return stepPin != -1 && dirPin != -1;
+    }
+    inline std::array<OutputEvent, 3> outputSequence(const Event &evt) const {
+        return {{OutputEvent(evt.time(), dirPin, evt.direction() == StepForward),
+            OutputEvent(evt.time(), stepPin, false),
+            OutputEvent(evt.time()+pulseWidth, stepPin, true)}}; //It's the low->high transition that triggers the step.
+    }
+};
+
+#endif
@@ -0,0 +1,30 @@
+#Formats a set of probed bed heights as a drv::BedMesh (see src/drivers/bedmesh.h)
+#Usage: python bedmesh.py < probed.txt
+#  where each line of probed.txt is "x y z" (in mm) for one node of a regular grid, in any order.
+#  z is the height at which the nozzle touched the bed, relative to where it should have (eg the reading of a probe at z=0).
+import sys
+
+points = {}
+for line in sys.stdin:
+	fields = line.split()
+	if len(fields) != 3:
+		continue
+	x, y, z = [float(f) for f in fields]
+	points[(round(x, 3), round(y, 3))] = z
+
+xs = sorted(set(x for x, y in points))
+ys = sorted(set(y for x, y in points))
+spacing = xs[1] - xs[0]
+for a in (xs, ys):
+	for i in range(1, len(a)):
+		if abs(a[i] - a[i-1] - spacing) > 1e-3:
+			sys.exit("probed points must lie on a square grid")
+for x in xs:
+	for y in ys:
+		if (x, y) not in points:
+			sys.exit("missing a probe at (%f, %f)" %(x, y))
+
+rows = []
+for y in ys:
+	rows.append(", ".join("%i" %int(round(points[(x, y)]*1000)) for x in xs))
+print("typedef BedMesh<%i, %i, %i, %i, %i, \n%s> _BedMeshT;" %(int(round(xs[0]*1000)), int(round(ys[0]*1000)), int(round(spacing*1000)), len(xs), len(ys), ", \n".join(rows)))